@@ -6,12 +6,23 @@
 /*
 * AABB and intersection with a ray
 * (bounding box aligned with the axes for faster intersection tests)
+* The box can move linearly during the shutter interval: it is equal 
+* to _box at time 0 and each bound is shifted by _motion at time 1.
 */
 class AABB {
 public:
-  AABB() {}
-  AABB(const Interval &x, const Interval &y, const Interval &z) : _box{x, y, z} {}
-  virtual ~AABB() {}
+  AABB(): _moving(false) {}
+  AABB(const Interval &x, const Interval &y, const Interval &z) : _box{x, y, z}, _moving(false) {}
+  /**
+   *  Box moving from start (at time 0) to end (at time 1)
+   *  start and end are expected to be static boxes
+   */
+  AABB(const AABB &start, const AABB &end): AABB(start) {
+    for (unsigned int i = 0; i < 3; ++i) {
+      _motion[i] = Interval(end._box[i].min - _box[i].min, end._box[i].max - _box[i].max);
+    }
+    _moving = true;
+  }
   bool hit(const Ray &ray) const {
     // this is almost a copy paste from: 
     // https://raytracing.github.io/books/RayTracingTheNextWeek.html#boundingvolumehierarchies/constructingboundingboxesforhittables
@@ -21,8 +32,14 @@ public:
     for (int a = 0; a < 3; a++) {
       auto invD = 1.0 / ray.direction()[a];
       auto orig = ray.origin()[a];
-      auto t0 = (_box[a].min - orig) * invD;
-      auto t1 = (_box[a].max - orig) * invD;
+      auto min = _box[a].min;
+      auto max = _box[a].max;
+      if (_moving) {
+        min += _motion[a].min * ray.time();
+        max += _motion[a].max * ray.time();
+      }
+      auto t0 = (min - orig) * invD;
+      auto t1 = (max - orig) * invD;
       if (invD < 0) {
         std::swap(t0, t1);
       }
@@ -38,15 +55,80 @@ public:
     }
     return true;
   }
+  /**
+   *  Interval at time 0
+   */
   const Interval &getInterval(unsigned int axis) const {return _box[axis];}
+  
+  /**
+   *  Interval at a given time in [0, 1]
+   */
+  Interval getInterval(unsigned int axis, double time) const {
+    if (!_moving) {
+      return _box[axis];
+    }
+    return Interval(_box[axis].min + _motion[axis].min * time, 
+        _box[axis].max + _motion[axis].max * time);
+  }
+
+  /**
+   *  Interval covering the whole shutter interval
+   */
+  Interval getSweptInterval(unsigned int axis) const {
+    auto res = getInterval(axis, 0.0);
+    res.unionWith(getInterval(axis, 1.0));
+    return res;
+  }
+
+  bool isMoving() const {return _moving;}
+
+  /**
+   *  Return true if the two boxes overlap at some time of the shutter
+   *  interval (conservative for moving boxes)
+   */
+  bool overlaps(const AABB &other) const {
+    for (unsigned int i = 0; i < 3; ++i) {
+      auto a = getSweptInterval(i);
+      auto b = other.getSweptInterval(i);
+      if (a.max < b.min || b.max < a.min) {
+        return false;
+      }
+    }
+    return true;
+  }
+  
+  /**
+   *  Same box shifted by offset
+   */
+  AABB translated(const Vec3 &offset) const {
+    AABB res = *this;
+    for (unsigned int i = 0; i < 3; ++i) {
+      res._box[i] = Interval(_box[i].min + offset[i], _box[i].max + offset[i]);
+    }
+    return res;
+  }
 
   void unionWith(const AABB &other) {
+    if (!_moving && !other._moving) {
+      for (unsigned int i = 0; i < 3; ++i) {
+        _box[i].unionWith(other._box[i]);
+      }
+      return;
+    }
+    // the min (resp. max) bound of the union is concave (resp. convex) 
+    // in time, so interpolating the unions at time 0 and 1 is conservative
     for (unsigned int i = 0; i < 3; ++i) {
+      auto end = getInterval(i, 1.0);
+      end.unionWith(other.getInterval(i, 1.0));
       _box[i].unionWith(other._box[i]);
+      _motion[i] = Interval(end.min - _box[i].min, end.max - _box[i].max);
     }
+    _moving = true;
   }
   friend std::ostream& operator<<(std::ostream &os, const AABB &v) { os << "(" << v._box[0] << "," << v._box[1] << "," << v._box[2] << ")"; return os;}
 private:
   Interval _box[3];
+  Interval _motion[3]{Interval(0.0, 0.0), Interval(0.0, 0.0), Interval(0.0, 0.0)};
+  bool _moving;
 };
 
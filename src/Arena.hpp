@@ -0,0 +1,181 @@
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <new>
+#include <thread>
+#include <type_traits>
+#include <utility>
+#include <vector>
+
+/**
+ *  Monotonic arena allocator
+ *  Objects are allocated contiguously in big chunks and are all freed
+ *  at once when the arena is cleared or destroyed: there is no per-object
+ *  deallocation. Only the destructors of the objects that are not
+ *  trivially destructible are called, so clearing an arena of trivially
+ *  destructible objects is O(number of chunks).
+ *
+ *  Each thread allocates in its own chunks (a "lane"), such that
+ *  concurrent allocations do not contend on a lock or share cache lines.
+ */
+class Arena {
+public:
+  /**
+   *  Constructor
+   *  @param chunkSize the size in bytes of the chunks requested to the system
+   */
+  Arena(size_t chunkSize = 1 << 20):
+    _chunkSize(chunkSize),
+    _id(_nextId()) {}
+  Arena(const Arena &) = delete;
+  Arena &operator=(const Arena &) = delete;
+  virtual ~Arena() {clear();}
+
+  /**
+   *  Allocate uninitialized memory
+   */
+  void *allocate(size_t size, size_t alignment = alignof(std::max_align_t)) {
+    return _getLane().allocate(size, alignment, _chunkSize);
+  }
+
+  /**
+   *  Construct an object of type T in the arena. The object
+   *  lives until the arena is cleared or destroyed
+   */
+  template<typename T, typename... Args>
+  T *make(Args&&... args) {
+    auto &lane = _getLane();
+    void *buffer = lane.allocate(sizeof(T), alignof(T), _chunkSize);
+    T *res = new (buffer) T(std::forward<Args>(args)...);
+    if (!std::is_trivially_destructible<T>::value) {
+      lane.destructors.push_back(Destructor{res, &_destroy<T>});
+    }
+    return res;
+  }
+
+  /**
+   *  Destroy all the objects and release the memory
+   *  Must not be called while other threads allocate
+   */
+  void clear() {
+    std::lock_guard<std::mutex> lock(_mutex);
+    for (auto &lane: _lanes) {
+      lane->clear();
+    }
+    _lanes.clear();
+    // invalidate the lanes cached by the threads
+    _id = _nextId();
+  }
+
+  /**
+   *  Number of bytes reserved from the system
+   */
+  size_t reservedBytes() const {
+    std::lock_guard<std::mutex> lock(_mutex);
+    size_t res = 0;
+    for (auto &lane: _lanes) {
+      res += lane->reserved;
+    }
+    return res;
+  }
+
+private:
+  struct Destructor {
+    void *object;
+    void (*destroy)(void *);
+  };
+
+  /**
+   *  Chunks and objects allocated by one thread
+   */
+  struct Lane {
+    Lane(): current(nullptr), remaining(0), reserved(0) {}
+    ~Lane() {clear();}
+
+    void *allocate(size_t size, size_t alignment, size_t chunkSize) {
+      auto padding = (alignment - reinterpret_cast<uintptr_t>(current) % alignment) % alignment;
+      if (current == nullptr || padding + size > remaining) {
+        // the object does not fit in the current chunk
+        auto newChunkSize = std::max(chunkSize, size + alignment);
+        chunks.push_back(std::unique_ptr<char[]>(new char[newChunkSize]));
+        current = chunks.back().get();
+        remaining = newChunkSize;
+        reserved += newChunkSize;
+        padding = (alignment - reinterpret_cast<uintptr_t>(current) % alignment) % alignment;
+      }
+      char *res = current + padding;
+      current = res + size;
+      remaining -= padding + size;
+      return res;
+    }
+
+    void clear() {
+      // destroy in reverse construction order
+      for (auto it = destructors.rbegin(); it != destructors.rend(); ++it) {
+        it->destroy(it->object);
+      }
+      destructors.clear();
+      chunks.clear();
+      current = nullptr;
+      remaining = 0;
+      reserved = 0;
+    }
+
+    std::thread::id owner;
+    std::vector<std::unique_ptr<char[]> > chunks;
+    std::vector<Destructor> destructors;
+    char *current; // first free byte in the last chunk
+    size_t remaining; // free bytes in the last chunk
+    size_t reserved;
+  };
+
+  template<typename T>
+  static void _destroy(void *object) {
+    static_cast<T *>(object)->~T();
+  }
+
+  static unsigned long _nextId() {
+    static std::atomic<unsigned long> counter(0);
+    return ++counter;
+  }
+
+  /**
+   *  Return the lane of the current thread. The last used lane is
+   *  cached per thread, so the lock is only taken when a thread
+   *  switches between arenas.
+   */
+  Lane &_getLane() {
+    thread_local unsigned long cachedId = 0;
+    thread_local Lane *cachedLane = nullptr;
+    if (cachedId == _id) {
+      return *cachedLane;
+    }
+    std::lock_guard<std::mutex> lock(_mutex);
+    auto threadId = std::this_thread::get_id();
+    Lane *lane = nullptr;
+    for (auto &l: _lanes) {
+      if (l->owner == threadId) {
+        lane = l.get();
+      }
+    }
+    if (!lane) {
+      _lanes.push_back(std::unique_ptr<Lane>(new Lane()));
+      lane = _lanes.back().get();
+      lane->owner = threadId;
+    }
+    cachedId = _id;
+    cachedLane = lane;
+    return *lane;
+  }
+
+private:
+  size_t _chunkSize;
+  unsigned long _id; // unique identifier, used to cache the lanes
+  mutable std::mutex _mutex;
+  std::vector<std::unique_ptr<Lane> > _lanes;
+};
@@ -0,0 +1,346 @@
+#pragma once
+
+#include <cmath>
+#include "Hit.hpp"
+#include "Material.hpp"
+#include "Vec3.hpp"
+
+/**
+ *  Scattering functions of the materials
+ *
+ *  Conventions: wo points from the hit point toward the previous vertex
+ *  of the path (opposite of the ray direction), wi toward the next one,
+ *  and the normal n of the hit is on the side of wo.
+ *  The functions switch on Material::Type instead of using virtual
+ *  calls, such that the materials stay plain values.
+ */
+
+/**
+ *  A direction sampled by sampleBsdf
+ */
+struct BsdfSample {
+  Vec3 direction; // wi
+  Vec3 weight; // bsdf * cos / pdf, the factor applied to the incoming light
+  double pdf; // solid angle density of direction (0 for specular samples)
+  bool specular; // sampled from a Dirac lobe (mirror, glass), cannot be evaluated
+};
+
+/**
+ *  Orthonormal basis (t, b, n) from a unit vector n (Duff et al. 2017)
+ */
+inline void buildBasis(const Vec3 &n, Vec3 &t, Vec3 &b) {
+  double sign = std::copysign(1.0, n[2]);
+  double a = -1.0 / (sign + n[2]);
+  double c = n[0] * n[1] * a;
+  t = Vec3(1.0 + sign * n[0] * n[0] * a, sign * c, -sign * n[0]);
+  b = Vec3(c, sign + n[1] * n[1] * a, -n[1]);
+}
+
+inline Vec3 reflect(const Vec3 &direction, const Vec3 &normal) {
+  return direction - normal * (normal * direction) * 2.0;
+}
+
+/**
+ *  Cosine weighted direction around n
+ */
+inline Vec3 sampleCosine(const Vec3 &n) {
+  auto direction = n + Vec3::getRandomUnitVector();
+  if (direction.normSquare() < 1e-12) {
+    // the random vector was opposite to the normal
+    return n;
+  }
+  return direction.getNormalized();
+}
+
+inline double getCosinePdf(const Vec3 &n, const Vec3 &wi) {
+  return std::max(0.0, n * wi) / M_PI;
+}
+
+/**
+ *  GGX (Trowbridge-Reitz) microfacet distribution with Smith masking
+ */
+struct GGX {
+  explicit GGX(double roughness):
+    alpha2(std::max(1e-6, roughness * roughness * roughness * roughness)) {}
+
+  double D(double cosH) const {
+    auto d = cosH * cosH * (alpha2 - 1.0) + 1.0;
+    return alpha2 / (M_PI * d * d);
+  }
+
+  double G1(double cosV) const {
+    return 2.0 * cosV / (cosV + std::sqrt(alpha2 + (1.0 - alpha2) * cosV * cosV));
+  }
+
+  /**
+   *  Draw a half vector proportionally to D(h) * cos(h)
+   */
+  Vec3 sampleHalfVector(const Vec3 &n) const {
+    auto phi = getRand(0.0, 2.0 * M_PI);
+    auto u = getRand(0.0, 1.0);
+    auto cos2 = (1.0 - u) / (1.0 + (alpha2 - 1.0) * u);
+    auto cosTheta = std::sqrt(cos2);
+    auto sinTheta = std::sqrt(std::max(0.0, 1.0 - cos2));
+    Vec3 t, b;
+    buildBasis(n, t, b);
+    return t * (sinTheta * std::cos(phi)) + b * (sinTheta * std::sin(phi)) + n * cosTheta;
+  }
+
+  double alpha2;
+};
+
+inline Vec3 getSchlickFresnel(const Vec3 &f0, double cosTheta) {
+  auto m = std::pow(1.0 - std::max(0.0, cosTheta), 5.0);
+  return f0 + (Vec3(1.0, 1.0, 1.0) - f0) * m;
+}
+
+/**
+ *  Fresnel reflectance of a smooth dielectric interface
+ *  @param eta ratio of the indices of refraction (incident / transmitted)
+ */
+inline double getDielectricFresnel(double cosI, double eta, double &cosT) {
+  auto sin2T = eta * eta * (1.0 - cosI * cosI);
+  if (sin2T >= 1.0) {
+    // total internal reflection
+    cosT = 0.0;
+    return 1.0;
+  }
+  cosT = std::sqrt(1.0 - sin2T);
+  auto rs = (eta * cosI - cosT) / (eta * cosI + cosT);
+  auto rp = (cosI - eta * cosT) / (cosI + eta * cosT);
+  return 0.5 * (rs * rs + rp * rp);
+}
+
+/**
+ *  True if the material only has Dirac lobes (or none), such that
+ *  sampling the lights is useless
+ */
+inline bool isSpecular(const Material &material) {
+  switch (material.getType()) {
+    case Material::Type::Weighted:
+      return material.getDiffusion() <= 0.0;
+    case Material::Type::Lambertian:
+      return false;
+    case Material::Type::Metal:
+      return material.getRoughness() == 0.0;
+    case Material::Type::Isotropic:
+      return false;
+    default:
+      return true;
+  }
+}
+
+/**
+ *  Power heuristic (beta = 2) weight of a sample drawn with density pdf,
+ *  when the other strategy has density otherPdf
+ */
+inline double getMisWeight(double pdf, double otherPdf) {
+  auto p2 = pdf * pdf;
+  auto o2 = otherPdf * otherPdf;
+  return p2 + o2 > 0.0 ? p2 / (p2 + o2) : 0.0;
+}
+
+/**
+ *  Reflection or refraction by a dielectric, chosen with the Fresnel
+ *  probability
+ *  @param ior index of refraction, at the wavelength of the path
+ */
+inline void sampleDielectric(const Material &material, double ior, const Vec3 &wo, const Hit &hit, BsdfSample &sample) {
+  const auto &n = hit.normal;
+  auto eta = hit.frontFace ? 1.0 / ior : ior;
+  auto cosI = std::min(1.0, n * wo);
+  double cosT;
+  auto fresnel = getDielectricFresnel(cosI, eta, cosT);
+  sample.specular = true;
+  sample.pdf = 0.0;
+  if (getRand(0.0, 1.0) < fresnel) {
+    sample.direction = reflect(-wo, n);
+    sample.weight = Vec3(1.0, 1.0, 1.0);
+  } else {
+    sample.direction = (-wo * eta + n * (eta * cosI - cosT)).getNormalized();
+    sample.weight = material.getColor(hit);
+  }
+}
+
+/**
+ *  Number of lobes of the material that can be sampled separately
+ */
+inline unsigned int getLobeCount(const Material &material) {
+  return material.getType() == Material::Type::Weighted ? 2 : 1;
+}
+
+/**
+ *  Draw the next direction of a path from one lobe of the material,
+ *  with importance sampling. Summing the samples of all the lobes
+ *  estimates the whole BSDF (lobe splitting).
+ *  @return false if the path is absorbed
+ */
+inline bool sampleBsdfLobe(const Material &material, unsigned int lobe, const Vec3 &wo, const Hit &hit, BsdfSample &sample) {
+  const auto &n = hit.normal;
+  sample.specular = false;
+  sample.pdf = 0.0;
+  switch (material.getType()) {
+    case Material::Type::Weighted:
+      if (lobe == 0) {
+        if (material.getDiffusion() <= 0.0) {
+          return false;
+        }
+        sample.direction = sampleCosine(n);
+        auto d = material.getDiffusion();
+        sample.weight = Vec3(d, d, d);
+        sample.pdf = getCosinePdf(n, sample.direction);
+      } else {
+        if (material.getReflection() <= 0.0) {
+          return false;
+        }
+        auto direction = reflect(-wo, n) + Vec3::getRandomUnitVector() * material.getFuzz();
+        sample.direction = direction.getNormalized();
+        sample.weight = material.getColor(hit) * material.getReflection();
+        sample.specular = true;
+      }
+      return true;
+    case Material::Type::Lambertian:
+      sample.direction = sampleCosine(n);
+      sample.weight = material.getColor(hit);
+      sample.pdf = getCosinePdf(n, sample.direction);
+      return true;
+    case Material::Type::Metal: {
+      auto cosO = n * wo;
+      if (cosO <= 0.0) {
+        return false;
+      }
+      if (material.getRoughness() == 0.0) {
+        sample.direction = reflect(-wo, n);
+        sample.weight = getSchlickFresnel(material.getColor(hit), cosO);
+        sample.specular = true;
+        return true;
+      }
+      GGX ggx(material.getRoughness());
+      auto h = ggx.sampleHalfVector(n);
+      auto cosOH = wo * h;
+      if (cosOH <= 0.0) {
+        return false;
+      }
+      sample.direction = reflect(-wo, h);
+      auto cosI = n * sample.direction;
+      if (cosI <= 0.0) {
+        // below the surface
+        return false;
+      }
+      auto cosH = n * h;
+      // bsdf * cos / pdf = F G (wo.h) / ((n.wo) (n.h))
+      auto g = ggx.G1(cosO) * ggx.G1(cosI);
+      sample.weight = getSchlickFresnel(material.getColor(hit), cosOH) * (g * cosOH / (cosO * cosH));
+      sample.pdf = ggx.D(cosH) * cosH / (4.0 * cosOH);
+      return true;
+    }
+    case Material::Type::Dielectric:
+      sampleDielectric(material, material.getIor(), wo, hit, sample);
+      return true;
+    case Material::Type::Emissive:
+      return false;
+    case Material::Type::Isotropic:
+      sample.direction = Vec3::getRandomUnitVector();
+      sample.weight = material.getColor(hit);
+      sample.pdf = 1.0 / (4.0 * M_PI);
+      return true;
+  }
+  return false;
+}
+
+/**
+ *  Draw the next direction of a path, with importance sampling.
+ *  Materials with several lobes pick one of them at random,
+ *  proportionally to the weights of the lobes.
+ *  @return false if the path is absorbed
+ */
+inline bool sampleBsdf(const Material &material, const Vec3 &wo, const Hit &hit, BsdfSample &sample) {
+  if (getLobeCount(material) == 1) {
+    return sampleBsdfLobe(material, 0, wo, hit, sample);
+  }
+  // Weighted: diffusion and reflection
+  auto total = material.getDiffusion() + material.getReflection();
+  if (total <= 0.0) {
+    return false;
+  }
+  auto diffuseProbability = material.getDiffusion() / total;
+  auto lobe = getRand(0.0, 1.0) < diffuseProbability ? 0u : 1u;
+  if (!sampleBsdfLobe(material, lobe, wo, hit, sample)) {
+    return false;
+  }
+  auto probability = lobe == 0 ? diffuseProbability : 1.0 - diffuseProbability;
+  sample.weight /= probability;
+  sample.pdf *= probability;
+  return true;
+}
+
+/**
+ *  bsdf(wo, wi) * cos(n, wi), without the Dirac lobes (the phase
+ *  function for the isotropic media)
+ */
+inline Vec3 evalBsdf(const Material &material, const Vec3 &wo, const Vec3 &wi, const Hit &hit) {
+  if (material.getType() == Material::Type::Isotropic) {
+    // phase function, no cosine
+    return material.getColor(hit) / (4.0 * M_PI);
+  }
+  const auto &n = hit.normal;
+  auto cosI = n * wi;
+  if (cosI <= 0.0) {
+    return Vec3();
+  }
+  switch (material.getType()) {
+    case Material::Type::Weighted: {
+      auto v = material.getDiffusion() * cosI / M_PI;
+      return Vec3(v, v, v);
+    }
+    case Material::Type::Lambertian:
+      return material.getColor(hit) * (cosI / M_PI);
+    case Material::Type::Metal: {
+      auto cosO = n * wo;
+      if (cosO <= 0.0 || material.getRoughness() == 0.0) {
+        return Vec3();
+      }
+      GGX ggx(material.getRoughness());
+      auto h = (wo + wi).getNormalized();
+      auto g = ggx.G1(cosO) * ggx.G1(cosI);
+      return getSchlickFresnel(material.getColor(hit), wo * h) * (ggx.D(n * h) * g / (4.0 * cosO));
+    }
+    default:
+      return Vec3();
+  }
+}
+
+/**
+ *  Density with which sampleBsdf draws wi, without the Dirac lobes
+ *  @param lobeSplitting density of sampleBsdfLobe instead, when all
+ *    the lobes are sampled
+ */
+inline double getBsdfPdf(const Material &material, const Vec3 &wo, const Vec3 &wi, const Hit &hit,
+    bool lobeSplitting = false)
+{
+  const auto &n = hit.normal;
+  switch (material.getType()) {
+    case Material::Type::Weighted: {
+      if (lobeSplitting) {
+        return getCosinePdf(n, wi);
+      }
+      auto total = material.getDiffusion() + material.getReflection();
+      return total > 0.0 ? getCosinePdf(n, wi) * material.getDiffusion() / total : 0.0;
+    }
+    case Material::Type::Lambertian:
+      return getCosinePdf(n, wi);
+    case Material::Type::Isotropic:
+      return 1.0 / (4.0 * M_PI);
+    case Material::Type::Metal: {
+      if (material.getRoughness() == 0.0 || n * wi <= 0.0) {
+        return 0.0;
+      }
+      GGX ggx(material.getRoughness());
+      auto h = (wo + wi).getNormalized();
+      auto cosOH = wo * h;
+      return cosOH > 0.0 ? ggx.D(n * h) * (n * h) / (4.0 * cosOH) : 0.0;
+    }
+    default:
+      return 0.0;
+  }
+}
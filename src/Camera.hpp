@@ -8,9 +8,23 @@
 #include <limits>
 #include <random>
 #include <thread>
+#include <atomic>
+#include <algorithm>
+#include <memory>
 #include "Hit.hpp"
+#include "Bsdf.hpp"
 #include "shapes/Shape.hpp"
 #include "Image.hpp"
+#include "Framebuffer.hpp"
+#include "Wavefront.hpp"
+#include "PostProcess.hpp"
+#include "Denoiser.hpp"
+#include "EnvironmentMap.hpp"
+#include "LightBVH.hpp"
+#include "Sampler.hpp"
+#include "Spectrum.hpp"
+#include "ThreadPool.hpp"
+#include "TileWriter.hpp"
 
 
 /**
@@ -19,8 +33,34 @@
 */
 class Camera {
   public:
+    /**
+     *  Algorithm used to trace the rays
+     *  Recursive: each path is traced depth first 
+     *  Wavefront: batches of rays are traced one bounce at a time
+     */
+    enum class Integrator {
+      Recursive,
+      Wavefront
+    };
+
+    /**
+     *  Features of a scene that the render kernels handle. The kernels
+     *  are compiled for each combination, such that the tests of the
+     *  features absent from a scene disappear from the bounce loop.
+     */
+    enum Feature : unsigned int {
+      Emission = 1, // some materials emit light
+      LightSampling = 2, // next event estimation toward the lights and the environment
+      MultipleLobes = 4, // some materials have several lobes, split at the first hit
+      AllFeatures = 7
+    };
+
+    static const unsigned int defaultMaxDepth = 10;
+
     /**
      * Constructor
+     * @param cores number of rendering threads, 0 for one per core.
+     *   The cameras with the same number share their threads.
     */
     Camera(double aspectRatio, unsigned int imageWidth, double vfov, unsigned int raysPerPixel,
     const Vec3 &lookFrom, const Vec3 &lookAt, unsigned int cores): 
@@ -34,21 +74,255 @@ class Camera {
       _lookUp(0.0, 1.0, 0.0),
       _vpWidth(0.0),
       _vpHeight(0.0),
-      _cores(cores),
+      _pixelSpread(0.0),
+      _pool(ThreadPool::getShared(cores)),
       _background1(1.0, 1.0, 1.0),
-      _background2(0.5, 0.5, 1.0)
+      _background2(0.5, 0.5, 1.0),
+      _shutterOpen(0.0),
+      _shutterClose(0.0),
+      _aperture(0.0),
+      _focusDistance(0.0),
+      _integrator(Integrator::Recursive),
+      _wavefrontBatchSize(1 << 16),
+      _sortRays(false),
+      _packetSize(1),
+      _tileSize(32),
+      _denoise(false),
+      _environment(nullptr),
+      _sampleEnvironment(false),
+      _lights(nullptr),
+      _maxDepth(defaultMaxDepth),
+      _sceneFeatures(Emission | MultipleLobes),
+      _spectral(false)
     {
 
     }
 
+    /**
+     *  Move the camera. Takes effect at the next call to render or
+     *  update.
+     */
+    void setView(const Vec3 &lookFrom, const Vec3 &lookAt, double vfov) {
+      _lookFrom = lookFrom;
+      _lookAt = lookAt;
+      _vfov = vfov;
+    }
+
+    const Vec3 &getLookFrom() const {return _lookFrom;}
+    const Vec3 &getLookAt() const {return _lookAt;}
+    double getVfov() const {return _vfov;}
+
+    /**
+     *  Set the resolution, the height follows the aspect ratio
+     */
+    void setImageWidth(unsigned int imageWidth) {_imageWidth = imageWidth;}
+    unsigned int getImageWidth() const {return _imageWidth;}
+    unsigned int getImageHeight() const {return _imageHeight;}
+
+    void setRaysPerPixel(unsigned int raysPerPixel) {_raysPerPixel = raysPerPixel;}
+    unsigned int getRaysPerPixel() const {return _raysPerPixel;}
+
+    /**
+     *  Width and height of the tiles rendered by the threads
+     */
+    unsigned int getTileSize() const {return _tileSize;}
+
+    /**
+     *  Number of tiles of the image, once its size is updated
+     */
+    unsigned int getTileCount() const {
+      return ((_imageWidth + _tileSize - 1) / _tileSize) * ((_imageHeight + _tileSize - 1) / _tileSize);
+    }
+
+    /**
+     *  Reset tile to the pixels of the tile of index t (in [0,
+     *  getTileCount()), row by row), clipped at the image borders
+     */
+    void resetTile(unsigned int t, Tile &tile) const {
+      unsigned int tilesX = (_imageWidth + _tileSize - 1) / _tileSize;
+      unsigned int x0 = (t % tilesX) * _tileSize;
+      unsigned int y0 = (t / tilesX) * _tileSize;
+      tile.reset(x0, y0, std::min(_tileSize, _imageWidth - x0), std::min(_tileSize, _imageHeight - y0));
+    }
+
+    /**
+     *  Number of threads rendering the image
+     */
+    unsigned int getCores() const {return _pool->size();}
+
+    /**
+     *  Persistent threads of the camera, shared by its copies and the
+     *  other cameras with the same number of cores
+     */
+    ThreadPool &getThreadPool() const {return *_pool;}
+
+    /**
+     *  Copies of the world, one per NUMA node of the thread pool, each
+     *  one in the memory of its node: the threads render their tiles
+     *  with the copy of their node instead of the world given to
+     *  render (see Scene::replicateWorld). Empty to disable.
+     */
+    void setWorldReplicas(const std::vector<const Shape *> &replicas) {
+      assert(replicas.empty() || replicas.size() == _pool->getNodeCount());
+      _replicas = replicas;
+    }
+
+    /**
+     *  The replica of the world in the memory of the node of a worker
+     *  of the thread pool
+     */
+    const Shape &getLocalWorld(const Shape &world, unsigned int worker) const {
+      return _replicas.empty() ? world : *_replicas[_pool->getNode(worker)];
+    }
+
+    /**
+     *  Maximum number of bounces of the paths
+     */
+    void setMaxDepth(unsigned int maxDepth) {_maxDepth = maxDepth;}
+
+    /**
+     *  Find the features used by the materials of the scene, to select
+     *  the render kernel. To call after the creation of the scene or a
+     *  change of the materials (by default all the features are enabled).
+     */
+    void analyzeScene(const Shape &world) {
+      std::vector<const Material *> materials;
+      world.getMaterials(materials);
+      _sceneFeatures = 0;
+      for (auto material: materials) {
+        if (material->isEmissive()) {
+          _sceneFeatures |= Emission;
+        }
+        if (getLobeCount(*material) > 1) {
+          _sceneFeatures |= MultipleLobes;
+        }
+      }
+    }
+
+    /**
+     *  Features of the scene, and of the camera settings
+     */
+    unsigned int getFeatures() const {
+      auto features = _sceneFeatures;
+      if ((_environment && _sampleEnvironment) || _lights) {
+        features |= LightSampling;
+      }
+      return features;
+    }
+
     void setBackgrounds(const Vec3 &b1, const Vec3 &b2) {
       _background1 = b1;
       _background2 = b2;
     }
 
-    Vec3 getRayColor(const Ray &ray, const Shape &world, unsigned int depth) const {
+    /**
+     *  Set the shutter interval (times in [0, 1]). The rays are
+     *  cast at a random time in this interval, such that the moving
+     *  shapes are motion blurred.
+     */
+    void setShutter(double open, double close) {
+      assert(open <= close);
+      _shutterOpen = open;
+      _shutterClose = close;
+    }
+
+    /**
+     *  Set the lens of the camera, for depth of field. The points at
+     *  focusDistance from the camera are sharp, the others are blurred
+     *  proportionally to the aperture.
+     *  @param aperture diameter of the lens, 0 for a pinhole camera
+     *  @param focusDistance 0 to focus on lookAt
+     */
+    void setLens(double aperture, double focusDistance = 0.0) {
+      assert(aperture >= 0.0 && focusDistance >= 0.0);
+      _aperture = aperture;
+      _focusDistance = focusDistance;
+    }
+
+    /**
+     *  Set the integrator
+     *  @param batchSize for the wavefront integrator, number of 
+     *    camera rays traced together
+     */
+    void setIntegrator(Integrator integrator, unsigned int batchSize = 1 << 16) {
+      _integrator = integrator;
+      _wavefrontBatchSize = batchSize;
+    }
+
+    /**
+     *  Trace the paths with 4 wavelengths each instead of RGB colors
+     *  (see Wavelengths), converted to RGB when added to the image.
+     *  Needed for the dispersion of the dielectrics. The paths are
+     *  traced with the recursive integrator.
+     */
+    void setSpectral(bool spectral) {_spectral = spectral;}
+
+    /**
+     *  With the wavefront integrator, reorder the secondary rays of 
+     *  each batch by direction octant and origin (Morton code) before
+     *  the intersection stage
+     *  @param packetSize if greater than 1, the sorted rays are traced
+     *    by coherent packets of this size
+     */
+    void setRaySorting(bool sortRays, unsigned int packetSize = 1) {
+      _sortRays = sortRays;
+      _packetSize = std::max(1u, packetSize);
+    }
+
+    /**
+     *  Post-processing pipeline applied to the image before saving it
+     */
+    PostProcess &getPostProcess() {return _postProcess;}
+
+    /**
+     *  Enable the denoiser, guided by the albedo, normal and depth of
+     *  the first hits. It makes a low number of rays per pixel (32-64)
+     *  comparable to a much higher one.
+     */
+    void setDenoising(bool denoise) {_denoise = denoise;}
+    bool isDenoising() const {return _denoise;}
+
+    /**
+     *  Parameters of the denoiser
+     */
+    Denoiser &getDenoiser() {return _denoiser;}
+
+    /**
+     *  Use an environment map (not owned) as the sky instead of the
+     *  background colors
+     *  @param importanceSampling if true, a direction is also drawn from the
+     *    environment at each diffuse or glossy hit (next event estimation),
+     *    and combined with the BSDF samples by multiple importance sampling
+     */
+    void setEnvironment(const EnvironmentMap *environment, bool importanceSampling = true) {
+      _environment = environment;
+      _sampleEnvironment = importanceSampling;
+    }
+
+    /**
+     *  Emissive shapes (not owned) sampled at each diffuse or glossy hit
+     *  (next event estimation), combined with the BSDF samples by
+     *  multiple importance sampling. Null to only find the lights with
+     *  the BSDF samples. Scene::beforeRender sets it.
+     */
+    void setLights(const LightBVH *lights) {_lights = lights;}
+
+    /**
+     *  Light reaching the origin of the ray. One direction is sampled
+     *  from the BSDF at each bounce, with importance sampling, except
+     *  at the first hit where each lobe of the material is sampled once
+     *  (most of the noise comes from the choice of the first lobe).
+     *  @param pdf density of the BSDF sample that generated the ray,
+     *    0 for camera rays and specular bounces
+     *  @tparam Features features of the scene (see Feature), the code
+     *    of the others is removed
+     *  @tparam MaxDepth maximum number of bounces, 0 to read it at runtime
+     */
+    template<unsigned int Features = AllFeatures, unsigned int MaxDepth = 0>
+    Vec3 getRayColor(const Ray &ray, const Shape &world, unsigned int depth, double pdf = 0.0) const {
+        const unsigned int maxDepth = MaxDepth ? MaxDepth : _maxDepth;
         auto color = Vec3(0.0, 0.0, 0.0);
-        if (depth > 10) {
+        if (depth > maxDepth) {
             return color;
         }
         
@@ -56,110 +330,633 @@ class Camera {
         const double minDist = 0.00001;
         if (world.hit(ray, minDist, hit)) {
             const auto &material = hit.shape->getMaterial();
-            
-            if (material.getAmbiant() > 0.0) {
-              color += material.getColor() * material.getAmbiant();
+            _setFootprint(material, ray, hit);
+            if (Features & Emission) {
+              color += _getEmission(material, ray, hit, pdf);
             }
-            if (material.getDiffusion() > 0.0) {
-                auto newDirection = hit.normal + Vec3::getRandomUnitVector();
-                Ray newRay(hit.point, newDirection);
-                color += getRayColor(newRay, world, depth + 1) * material.getDiffusion();
-                // TODO near zero
+            Ray shadowRay;
+            double maxDist;
+            Vec3 light;
+            if ((Features & LightSampling) && depth < maxDepth
+                && _sampleLight(material, ray, hit, depth == 0, shadowRay, maxDist, light)) {
+              Hit shadowHit;
+              shadowHit.dist = maxDist;
+              if (!world.hit(shadowRay, minDist, shadowHit)) {
+                color += light;
+              }
             }
-            
-            if (material.getReflection() > 0.0) {
-                auto newDirection = ray.direction() - hit.normal * (hit.normal * ray.direction()) * 2.0;
-                newDirection += Vec3::getRandomUnitVector() * material.getFuzz();
-                Ray newRay(hit.point, newDirection);
-                auto temp = getRayColor(newRay, world, depth + 1) * material.getReflection();
-                for (unsigned int i = 0; i < 3; ++i) {
-                    temp[i] *= material.getColor()[i];
+            BsdfSample sample;
+            if ((Features & MultipleLobes) && depth == 0) {
+              for (unsigned int lobe = 0; lobe < getLobeCount(material); ++lobe) {
+                if (sampleBsdfLobe(material, lobe, -ray.direction(), hit, sample)) {
+                  auto newRay = _getNextRay(ray, hit, sample.direction, sample.pdf);
+                  color += sample.weight.multiply(getRayColor<Features, MaxDepth>(newRay, world, depth + 1, sample.pdf));
                 }
-                color += temp;
+              }
+            } else if (sampleBsdf(material, -ray.direction(), hit, sample)) {
+                auto newRay = _getNextRay(ray, hit, sample.direction, sample.pdf);
+                color += sample.weight.multiply(getRayColor<Features, MaxDepth>(newRay, world, depth + 1, sample.pdf));
             }
         } else {
-            auto t = 0.5 * (ray.direction()[1] + 1.0);
-            color = _background1 * (1.0-t) + _background2 * t;
-            //color = Vec3(0.1, 0.1, 0.1);
+            color = getBackground(ray, pdf);
         }
         return color;
     }
 
+    /**
+     *  Same as getRayColor, for the wavelengths of the path. At a
+     *  dispersive dielectric, the path follows the hero wavelength and
+     *  the others are terminated.
+     *  @param heroOnly a previous vertex of the path was dispersive
+     */
+    template<unsigned int Features = AllFeatures, unsigned int MaxDepth = 0>
+    Spectrum getRaySpectrum(const Ray &ray, const Shape &world, const Wavelengths &wavelengths, unsigned int depth,
+        double pdf = 0.0, bool heroOnly = false) const {
+        const unsigned int maxDepth = MaxDepth ? MaxDepth : _maxDepth;
+        Spectrum spectrum;
+        if (depth > maxDepth) {
+            return spectrum;
+        }
 
-    Ray getRay(unsigned int x, unsigned int y) const {
-      double rightFactor = static_cast<double>(x) + getRand(-0.5, 0.5);
-      double downFactor = static_cast<double>(y) + getRand(-0.5, 0.5);
-      if (_raysPerPixel == 1) {
+        Hit hit;
+        const double minDist = 0.00001;
+        if (!world.hit(ray, minDist, hit)) {
+            return wavelengths.fromRgb(getBackground(ray, pdf));
+        }
+        const auto &material = hit.shape->getMaterial();
+        _setFootprint(material, ray, hit);
+        if (Features & Emission) {
+          spectrum += wavelengths.fromRgb(_getEmission(material, ray, hit, pdf));
+        }
+        Ray shadowRay;
+        double maxDist;
+        Vec3 light;
+        if ((Features & LightSampling) && depth < maxDepth
+            && _sampleLight(material, ray, hit, depth == 0, shadowRay, maxDist, light)) {
+          Hit shadowHit;
+          shadowHit.dist = maxDist;
+          if (!world.hit(shadowRay, minDist, shadowHit)) {
+            spectrum += wavelengths.fromRgb(light);
+          }
+        }
+        BsdfSample sample;
+        if (material.getType() == Material::Type::Dielectric && material.getDispersion() != 0.0) {
+          sampleDielectric(material, material.getIor(wavelengths[0]), -ray.direction(), hit, sample);
+          auto newRay = _getNextRay(ray, hit, sample.direction, 0.0);
+          auto incoming = getRaySpectrum<Features, MaxDepth>(newRay, world, wavelengths, depth + 1, 0.0, true);
+          if (!heroOnly) {
+            incoming = Wavelengths::terminateSecondary(incoming);
+          }
+          spectrum += wavelengths.fromRgb(sample.weight) * incoming;
+        } else if ((Features & MultipleLobes) && depth == 0) {
+          for (unsigned int lobe = 0; lobe < getLobeCount(material); ++lobe) {
+            if (sampleBsdfLobe(material, lobe, -ray.direction(), hit, sample)) {
+              auto newRay = _getNextRay(ray, hit, sample.direction, sample.pdf);
+              spectrum += wavelengths.fromRgb(sample.weight)
+                * getRaySpectrum<Features, MaxDepth>(newRay, world, wavelengths, depth + 1, sample.pdf, heroOnly);
+            }
+          }
+        } else if (sampleBsdf(material, -ray.direction(), hit, sample)) {
+          auto newRay = _getNextRay(ray, hit, sample.direction, sample.pdf);
+          spectrum += wavelengths.fromRgb(sample.weight)
+            * getRaySpectrum<Features, MaxDepth>(newRay, world, wavelengths, depth + 1, sample.pdf, heroOnly);
+        }
+        return spectrum;
+    }
+
+    /**
+     *  Light coming from the sky in the direction of the ray
+     *  @param pdf density of the BSDF sample that generated the ray,
+     *    to weight the environment with the light samples
+     */
+    Vec3 getBackground(const Ray &ray, double pdf = 0.0) const {
+      if (_environment) {
+        // filtered for the camera rays and the specular bounces only:
+        // over the wide cones of the diffuse bounces, the sun of an HDR
+        // sky would spread into the directions weighted by the BSDF
+        auto radiance = _environment->getRadiance(ray.direction(), pdf > 0.0 ? 0.0 : _environment->getLod(ray.spread()));
+        if (_sampleEnvironment && pdf > 0.0) {
+          radiance *= getMisWeight(pdf, _getEnvironmentProbability() * _environment->getPdf(ray.direction()));
+        }
+        return radiance;
+      }
+      auto t = 0.5 * (ray.direction()[1] + 1.0);
+      return _background1 * (1.0-t) + _background2 * t;
+      //return Vec3(0.1, 0.1, 0.1);
+    }
+
+
+    /**
+     *  Camera ray of the sample index of the pixel (x, y)
+     *  With an aperture, the origin of the ray is on the lens and the
+     *  ray goes through the point of the focus plane seen in the pixel.
+     */
+    Ray getRay(unsigned int x, unsigned int y, const PixelSampler &sampler, unsigned int index) const {
+      double rightFactor = static_cast<double>(x) + sampler.get(index, PixelSampler::PixelX) - 0.5;
+      double downFactor = static_cast<double>(y) + sampler.get(index, PixelSampler::PixelY) - 0.5;
+      // a single ray goes through the center of the pixel
+      if (_raysPerPixel == 1 && index == 0) {
         rightFactor = static_cast<double>(x);
         downFactor = static_cast<double>(y);
       }
       auto cell = _vpCorner + _cellOffsetRight * rightFactor + _cellOffsetDown * downFactor;
-      return Ray(_lookFrom, cell - _lookFrom);
+      double time = _shutterOpen;
+      if (_shutterClose > _shutterOpen) {
+        time = _shutterOpen + sampler.get(index, PixelSampler::Time) * (_shutterClose - _shutterOpen);
+      }
+      auto origin = _lookFrom;
+      if (_aperture > 0.0) {
+        double lensX, lensY;
+        PixelSampler::toDisk(sampler.get(index, PixelSampler::LensU), sampler.get(index, PixelSampler::LensV), lensX, lensY);
+        origin += _lensRight * (lensX * _aperture / 2.0) + _lensUp * (lensY * _aperture / 2.0);
+      }
+      Ray ray(origin, cell - origin, time);
+      // the cone covers the pixel in the focus plane
+      ray.setCone(0.0, _pixelSpread);
+      return ray;
     }
 
 
+    /**
+     *  Recompute the viewport after a change of the view or of the
+     *  resolution (render does it)
+     */
+    void update() {_updateParameters();}
+
     void render(const Shape &world) {
+      std::string output = "C:\\Users\\benom\\github\\RayTracer\\src\\output.ppm";
+      std::cout << "Output in " << output << std::endl;
+      // the denoiser and the blur need the whole image
+      if (!_denoise && _postProcess.isPointwise()) {
+        renderToFile(world, output);
+        return;
+      }
+      auto image = renderImage(world);
+      image.writePPM(output);
+    }
+
+    /**
+     *  Render the image and write its tiles to a file as soon as they
+     *  are finished, by a background thread (see TileWriter), without
+     *  storing the whole image. The denoiser and the blur of the post
+     *  processing are not applied, since they need the neighbour tiles.
+     */
+    void renderToFile(const Shape &world, const std::string &output,
+        TileWriter::Format format = TileWriter::Format::PPM) {
       _updateParameters();
-      Image image(_imageWidth, _imageHeight);
-      unsigned int pixelsNumber = _imageWidth * _imageHeight;
-      std::vector<std::thread> threads;
-      unsigned int threadsNumber = _cores;
-      unsigned int chunkSize = pixelsNumber / threadsNumber;
-      if (_cores == 1) {
-          renderAux(world, image, 0, pixelsNumber);
+      TileWriter writer(output, _imageWidth, _imageHeight, _tileSize, format);
+      unsigned int tilesNumber = getTileCount();
+      std::atomic<unsigned int> nextTile(0);
+      _pool->run([&](unsigned int worker) {
+        const auto &localWorld = getLocalWorld(world, worker);
+        auto &tile = _getScratch().tile;
+        while (true) {
+          unsigned int t = nextTile++;
+          if (t >= tilesNumber) {
+            break;
+          }
+          resetTile(t, tile);
+          renderTile(localWorld, tile);
+          std::vector<uint8_t> rgb(3 * tile.size());
+          _postProcess.applyTile(tile, rgb.data());
+          writer.push(tile.x0, tile.y0, tile.width, tile.height, std::move(rgb));
+        }
+      });
+      writer.finish();
+    }
+
+    /**
+     *  Render the final image (denoised and post processed) in memory
+     */
+    Image renderImage(const Shape &world) {
+      _updateParameters();
+      // the variance of the pixels guides the denoiser
+      AccumulationBuffer accumulation(_imageWidth, _imageHeight, false, _denoise);
+      accumulation.setSamplesPerPixel(_raysPerPixel);
+      if (_denoise) {
+        FeatureBuffer features(_imageWidth, _imageHeight);
+        renderTiles(world, accumulation, &features);
+        _denoiser.apply(accumulation, features, *_pool);
       } else {
-          for (unsigned int i = 0; i < threadsNumber; ++i) {
-              unsigned int start = i * chunkSize;
-              unsigned int end = (i == threadsNumber - 1) ? pixelsNumber : (i + 1) * chunkSize;
-              threads.push_back(std::thread(&Camera::renderAux, this, std::ref(world), std::ref(image), start, end));
+        renderTiles(world, accumulation);
+      }
+      // for instance blur and cartoonize with 
+      // getPostProcess().setBlur(1.0) and getPostProcess().setQuantization(8)
+      Image image(_imageWidth, _imageHeight);
+      _postProcess.apply(accumulation, image, *_pool);
+      return image;
+    }
+
+    /**
+     *  Render the whole image into accumulation. The image is split into
+     *  tiles, and each thread picks the next tile to render from a shared
+     *  counter, renders it in its own Tile buffer and writes it back.
+     *  @param features if not null, also filled with the first hits
+     *  @param firstSample index of the first sample of each pixel, to
+     *    continue the sample sequences of a previous call
+     *  @param cancel if not null, the rendering stops before the next
+     *    tile when it becomes true
+     *  @return false if cancelled (the image is then incomplete)
+     */
+    bool renderTiles(const Shape &world, AccumulationBuffer &accumulation, FeatureBuffer *features = nullptr,
+        unsigned int firstSample = 0, const std::atomic<bool> *cancel = nullptr) const {
+      unsigned int tilesNumber = getTileCount();
+      std::atomic<unsigned int> nextTile(0);
+      _pool->run([&](unsigned int worker) {
+        const auto &localWorld = getLocalWorld(world, worker);
+        auto &tile = _getScratch().tile;
+        while (true) {
+          unsigned int t = nextTile++;
+          if (t >= tilesNumber || (cancel && *cancel)) {
+            break;
           }
-          for (auto& thread : threads) {
-              thread.join();
+          resetTile(t, tile);
+          renderTile(localWorld, tile, firstSample);
+          accumulation.addTile(tile);
+          if (features) {
+            renderFeatures(localWorld, tile, *features);
           }
+        }
+      });
+      return !(cancel && *cancel);
+    }
+
+    /**
+     *  Trace _raysPerPixel rays for each pixel of the tile
+     *  @param firstSample index of the first of these samples
+     */
+    void renderTile(const Shape &world, Tile &tile, unsigned int firstSample = 0) const {
+      // the kernel of the default depth is compiled with a constant
+      if (_maxDepth == defaultMaxDepth) {
+        _renderTile<defaultMaxDepth>(world, tile, firstSample);
+      } else {
+        _renderTile<0>(world, tile, firstSample);
       }
-      //image.blur();
-      //image.cartoonize(8);
-      // save
-      std::string output = "C:\\Users\\benom\\github\\RayTracer\\src\\output.ppm";
-      std::cout << "Output in " << output << std::endl;
-      image.writePPM(output);
     }
 
-    void renderAux(const Shape &world, Image &image, unsigned int start, unsigned int end)  const {
-      for (unsigned int i = start; i < end; ++i) {
-        unsigned int x = i % _imageWidth;
-        unsigned int y = i / _imageWidth;
-        Vec3 averageColor;
+    /**
+     *  renderTile with the recursive integrator
+     */
+    template<unsigned int Features = AllFeatures, unsigned int MaxDepth = 0>
+    void renderTileRecursive(const Shape &world, Tile &tile, unsigned int firstSample = 0) const {
+      for (unsigned int i = 0; i < tile.size(); ++i) {
+        unsigned int x = tile.x0 + i % tile.width;
+        unsigned int y = tile.y0 + i / tile.width;
+        PixelSampler sampler(x, y);
         for (unsigned int it = 0; it < _raysPerPixel; ++it) {
-          auto ray = getRay(x, y);
-          averageColor += getRayColor(ray, world, 0);
-        }
-        // average
-        averageColor /= double(_raysPerPixel);
-        // linear to scalar scale
-        /*
-        averageColor[0] = sqrt(averageColor[0]);
-        averageColor[1] = sqrt(averageColor[1]);
-        averageColor[2] = sqrt(averageColor[2]);
-        */
-        // from [0,1] to [0, 255]
-        
-        for (unsigned int i = 0; i < 3; ++i) {
-          averageColor[i] = std::min(1.0, averageColor[i]);
+          auto ray = getRay(x, y, sampler, firstSample + it);
+          tile.addSample(i, getRayColor<Features, MaxDepth>(ray, world, 0));
+        }
+      }
+      tile.samples += _raysPerPixel;
+    }
+
+    /**
+     *  renderTile with spectral paths, converted to RGB for each sample
+     */
+    template<unsigned int Features = AllFeatures, unsigned int MaxDepth = 0>
+    void renderTileSpectral(const Shape &world, Tile &tile, unsigned int firstSample = 0) const {
+      for (unsigned int i = 0; i < tile.size(); ++i) {
+        unsigned int x = tile.x0 + i % tile.width;
+        unsigned int y = tile.y0 + i / tile.width;
+        PixelSampler sampler(x, y);
+        for (unsigned int it = 0; it < _raysPerPixel; ++it) {
+          auto ray = getRay(x, y, sampler, firstSample + it);
+          Wavelengths wavelengths(sampler.get(firstSample + it, PixelSampler::Wavelength));
+          tile.addSample(i, wavelengths.toRgb(getRaySpectrum<Features, MaxDepth>(ray, world, wavelengths, 0)));
         }
-        averageColor *= 255.0;
-        image(x, y) = averageColor;
       }
+      tile.samples += _raysPerPixel;
     }
 
+    /**
+     *  Same as renderTile, with the wavefront integrator
+     *  The samples are processed by batches of _wavefrontBatchSize rays.
+     *  For each bounce, all the rays of the queue are intersected with
+     *  the scene, the hits are sorted by shape and shaded, and the 
+     *  secondary rays are appended to the queue of the next bounce.
+     *  Computes the same estimator as getRayColor.
+     */
+    template<unsigned int Features = AllFeatures, unsigned int MaxDepth = 0>
+    void renderTileWavefront(const Shape &world, Tile &tile, unsigned int firstSample = 0) const {
+      const unsigned int maxDepth = MaxDepth ? MaxDepth : _maxDepth;
+      auto &scratch = _getScratch();
+      auto &current = scratch.current;
+      auto &next = scratch.next;
+      const double minDist = 0.00001;
+      unsigned int pixelsPerBatch = std::max(1u, _wavefrontBatchSize / _raysPerPixel);
+      // color of each sample of the batch
+      auto &sampleColors = scratch.sampleColors;
+      auto &shadows = scratch.shadows;
+      shadows.clear();
+      for (unsigned int batchStart = 0; batchStart < tile.size(); batchStart += pixelsPerBatch) {
+        auto batchEnd = std::min(tile.size(), batchStart + pixelsPerBatch);
+        sampleColors.assign((batchEnd - batchStart) * _raysPerPixel, Vec3());
+        // camera rays generation
+        current.clear();
+        for (unsigned int i = batchStart; i < batchEnd; ++i) {
+          unsigned int x = tile.x0 + i % tile.width;
+          unsigned int y = tile.y0 + i / tile.width;
+          PixelSampler sampler(x, y);
+          for (unsigned int it = 0; it < _raysPerPixel; ++it) {
+            auto ray = getRay(x, y, sampler, firstSample + it);
+            auto sample = (i - batchStart) * _raysPerPixel + it;
+            current.paths.push_back(PathState(ray, Vec3(1.0, 1.0, 1.0), sample, 0));
+          }
+        }
+        while (!current.paths.empty()) {
+          // the camera rays are already coherent
+          if (_sortRays && current.paths[0].depth > 0) {
+            current.sortByCoherence(world.getAABB());
+          }
+          current.intersect(world, minDist, _packetSize);
+          // escaped rays
+          for (auto index: current.missIndices) {
+            auto &path = current.paths[index];
+            sampleColors[path.sample] += path.weight.multiply(getBackground(path.ray, path.pdf));
+          }
+          // shading, and compaction of the surviving rays into the next queue
+          for (auto index: current.hitIndices) {
+            auto &path = current.paths[index];
+            auto &hit = current.hits[index];
+            const auto &material = hit.shape->getMaterial();
+            _setFootprint(material, path.ray, hit);
+            if (Features & Emission) {
+              sampleColors[path.sample] += path.weight.multiply(_getEmission(material, path.ray, hit, path.pdf));
+            }
+            if (path.depth >= maxDepth) {
+              continue;
+            }
+            ShadowRay shadow;
+            Vec3 light;
+            if ((Features & LightSampling)
+                && _sampleLight(material, path.ray, hit, path.depth == 0, shadow.ray, shadow.maxDist, light)) {
+              shadow.contribution = path.weight.multiply(light);
+              shadow.sample = path.sample;
+              shadows.push_back(shadow);
+            }
+            BsdfSample sample;
+            if ((Features & MultipleLobes) && path.depth == 0) {
+              // lobe splitting, as in getRayColor
+              for (unsigned int lobe = 0; lobe < getLobeCount(material); ++lobe) {
+                if (sampleBsdfLobe(material, lobe, -path.ray.direction(), hit, sample)) {
+                  auto newRay = _getNextRay(path.ray, hit, sample.direction, sample.pdf);
+                  next.paths.push_back(PathState(newRay, path.weight.multiply(sample.weight), path.sample, path.depth + 1, sample.pdf));
+                }
+              }
+            } else if (sampleBsdf(material, -path.ray.direction(), hit, sample)) {
+              auto newRay = _getNextRay(path.ray, hit, sample.direction, sample.pdf);
+              next.paths.push_back(PathState(newRay, path.weight.multiply(sample.weight), path.sample, path.depth + 1, sample.pdf));
+            }
+          }
+          // occlusion of the light samples
+          for (auto &shadow: shadows) {
+            Hit shadowHit;
+            shadowHit.dist = shadow.maxDist;
+            if (!world.hit(shadow.ray, minDist, shadowHit)) {
+              sampleColors[shadow.sample] += shadow.contribution;
+            }
+          }
+          std::swap(current, next);
+          next.clear();
+          shadows.clear();
+        }
+        for (unsigned int sample = 0; sample < sampleColors.size(); ++sample) {
+          tile.addSample(batchStart + sample / _raysPerPixel, sampleColors[sample]);
+        }
+      }
+      tile.samples += _raysPerPixel;
+    }
+
+    /**
+     *  Fill the feature buffer for the pixels of a tile, with a few
+     *  camera rays per pixel. The rays that miss have the background
+     *  as albedo, no normal and an infinite depth.
+     */
+    void renderFeatures(const Shape &world, const Tile &tile, FeatureBuffer &features) const {
+      const double minDist = 0.00001;
+      const unsigned int featureSamples = std::min(4u, _raysPerPixel);
+      for (unsigned int i = 0; i < tile.size(); ++i) {
+        unsigned int x = tile.x0 + i % tile.width;
+        unsigned int y = tile.y0 + i / tile.width;
+        Vec3 albedo;
+        Vec3 normal;
+        double depth = 0.0;
+        PixelSampler sampler(x, y);
+        for (unsigned int it = 0; it < featureSamples; ++it) {
+          auto ray = getRay(x, y, sampler, it);
+          Hit hit;
+          if (world.hit(ray, minDist, hit)) {
+            const auto &material = hit.shape->getMaterial();
+            _setFootprint(material, ray, hit);
+            albedo += material.getColor(hit);
+            normal += hit.normal;
+            depth += hit.dist;
+          } else {
+            albedo += getBackground(ray);
+            depth += std::numeric_limits<float>::max() / featureSamples;
+          }
+        }
+        features.set(x, y, albedo / featureSamples, normal / featureSamples, depth / featureSamples);
+      }
+    }
+
+    /**
+     *  Tile buffer of the calling thread, reused by the loops over the
+     *  tiles (see Scratch)
+     */
+    static Tile &getScratchTile() {return _getScratch().tile;}
+
   private:
+    /**
+     *  Buffers reused by all the tiles that a thread renders. Since they
+     *  are allocated and first written by this thread, which the pool
+     *  pins to a core, their memory is on the NUMA node of the thread.
+     */
+    struct Scratch {
+      Tile tile;
+      RayQueue current;
+      RayQueue next;
+      std::vector<Vec3> sampleColors;
+      std::vector<ShadowRay> shadows;
+    };
+
+    static Scratch &_getScratch() {
+      static thread_local Scratch scratch;
+      return scratch;
+    }
+
+    /**
+     *  Call the kernel matching the features of the scene
+     */
+    template<unsigned int MaxDepth>
+    void _renderTile(const Shape &world, Tile &tile, unsigned int firstSample) const {
+      switch (getFeatures()) {
+        case 0: _renderTileKernel<0, MaxDepth>(world, tile, firstSample); break;
+        case 1: _renderTileKernel<1, MaxDepth>(world, tile, firstSample); break;
+        case 2: _renderTileKernel<2, MaxDepth>(world, tile, firstSample); break;
+        case 3: _renderTileKernel<3, MaxDepth>(world, tile, firstSample); break;
+        case 4: _renderTileKernel<4, MaxDepth>(world, tile, firstSample); break;
+        case 5: _renderTileKernel<5, MaxDepth>(world, tile, firstSample); break;
+        case 6: _renderTileKernel<6, MaxDepth>(world, tile, firstSample); break;
+        default: _renderTileKernel<AllFeatures, MaxDepth>(world, tile, firstSample); break;
+      }
+    }
+
+    template<unsigned int Features, unsigned int MaxDepth>
+    void _renderTileKernel(const Shape &world, Tile &tile, unsigned int firstSample) const {
+      if (_spectral) {
+        renderTileSpectral<Features, MaxDepth>(world, tile, firstSample);
+      } else if (_integrator == Integrator::Wavefront) {
+        renderTileWavefront<Features, MaxDepth>(world, tile, firstSample);
+      } else {
+        renderTileRecursive<Features, MaxDepth>(world, tile, firstSample);
+      }
+    }
+
+    /**
+     *  Probability to sample the environment rather than a shape in
+     *  _sampleLight
+     */
+    double _getEnvironmentProbability() const {
+      if (!_environment || !_sampleEnvironment) {
+        return 0.0;
+      }
+      return _lights ? 0.5 : 1.0;
+    }
+
+    /**
+     *  Draw a direction toward the lights: the environment map, or a
+     *  point of an emissive shape chosen by the light BVH
+     *  @param ray the ray that hit the surface
+     *  @param shadowRay the ray to test for occlusion
+     *  @param maxDist distance of the light along the shadow ray
+     *  @param light the contribution of the light if not occluded,
+     *    weighted by multiple importance sampling
+     *  @return false if there is nothing to test
+     */
+    bool _sampleLight(const Material &material, const Ray &ray, const Hit &hit, bool lobeSplitting,
+        Ray &shadowRay, double &maxDist, Vec3 &light) const
+    {
+      auto wo = -ray.direction();
+      if (isSpecular(material)) {
+        return false;
+      }
+      auto environmentProbability = _getEnvironmentProbability();
+      if (environmentProbability >= 1.0 || (environmentProbability > 0.0 && getRand() < environmentProbability)) {
+        Vec3 direction;
+        double pdf;
+        auto radiance = _environment->sample(direction, pdf);
+        pdf *= environmentProbability;
+        if (pdf <= 0.0) {
+          return false;
+        }
+        auto bsdf = evalBsdf(material, wo, direction, hit);
+        if (bsdf.normSquare() == 0.0) {
+          return false;
+        }
+        auto bsdfPdf = getBsdfPdf(material, wo, direction, hit, lobeSplitting);
+        light = bsdf.multiply(radiance) * (getMisWeight(pdf, bsdfPdf) / pdf);
+        shadowRay = _getNextRay(ray, hit, direction, 0.0);
+        maxDist = std::numeric_limits<double>::max();
+        return true;
+      }
+      if (!_lights) {
+        return false;
+      }
+      double pmf;
+      auto shape = _lights->sample(hit.point, getRand(), pmf);
+      // the lights are convex, and do not light themselves
+      if (!shape || shape == hit.shape) {
+        return false;
+      }
+      Hit lightHit;
+      double pdf;
+      shape->sampleFrom(hit.point, getRand(), getRand(), lightHit, pdf);
+      pdf *= (1.0 - environmentProbability) * pmf;
+      auto direction = lightHit.point - hit.point;
+      auto distSquare = direction.normSquare();
+      if (distSquare <= 0.0 || pdf <= 0.0) {
+        return false;
+      }
+      direction /= std::sqrt(distSquare);
+      auto bsdf = evalBsdf(material, wo, direction, hit);
+      if (bsdf.normSquare() == 0.0) {
+        return false;
+      }
+      // the emission toward the point, as seen by the shadow ray
+      lightHit.frontFace = lightHit.normal * direction < 0.0;
+      if (!lightHit.frontFace) {
+        lightHit.normal = -lightHit.normal;
+      }
+      auto radiance = shape->getMaterial().getEmission(lightHit);
+      auto bsdfPdf = getBsdfPdf(material, wo, direction, hit, lobeSplitting);
+      light = bsdf.multiply(radiance) * (getMisWeight(pdf, bsdfPdf) / pdf);
+      shadowRay = _getNextRay(ray, hit, direction, 0.0);
+      // stop before the light itself
+      maxDist = std::sqrt(distSquare) * (1.0 - 1e-4);
+      return true;
+    }
+
+    /**
+     *  Ray leaving a hit, with the cone of the incoming ray: its width
+     *  at the hit, and its spread widened by the scattering. A BSDF
+     *  sample of density pdf stands for a solid angle of about 1 / pdf
+     *  (Suykens and Willems 2001). The specular bounces and the shadow
+     *  rays (pdf 0) keep the spread, the curvature of the surfaces is
+     *  ignored.
+     */
+    static Ray _getNextRay(const Ray &ray, const Hit &hit, const Vec3 &direction, double pdf) {
+      Ray res(hit.point, direction, ray.time());
+      res.setCone(ray.getFootprint(hit.dist), ray.spread() + (pdf > 0.0 ? 1.0 / std::sqrt(pdf) : 0.0));
+      return res;
+    }
+
+    /**
+     *  Texture coordinates of a hit of a textured surface, and footprint
+     *  of the ray cone in texture coordinates: its width, stretched by
+     *  the incidence, over the size of the surface (the texture covers
+     *  the whole surface once)
+     */
+    static void _setFootprint(const Material &material, const Ray &ray, Hit &hit) {
+      if (!material.getTexture()) {
+        return;
+      }
+      hit.shape->setTextureCoordinates(hit);
+      auto area = hit.shape->getArea();
+      auto cosine = std::abs(hit.normal * ray.direction());
+      if (area > 0.0 && cosine > 0.0) {
+        hit.footprint = ray.getFootprint(hit.dist) / (std::sqrt(area) * cosine);
+      }
+    }
+
+    /**
+     *  Emission of a hit surface. If the surface is one of the sampled
+     *  lights and the ray is a BSDF sample, weighted against the light
+     *  samples by multiple importance sampling.
+     *  @param pdf density of the BSDF sample that generated the ray
+     */
+    Vec3 _getEmission(const Material &material, const Ray &ray, const Hit &hit, double pdf) const {
+      auto emission = material.getEmission(hit);
+      if (!_lights || pdf <= 0.0) {
+        return emission;
+      }
+      auto pmf = _lights->getPmf(ray.origin(), hit.shape);
+      if (pmf <= 0.0) {
+        return emission;
+      }
+      auto lightPdf = (1.0 - _getEnvironmentProbability()) * pmf * hit.shape->getPdfFrom(ray.origin(), hit);
+      return emission * getMisWeight(pdf, lightPdf);
+    }
+
     /**
      * Update the different parameters of the camera before rendering
     */
     void _updateParameters() {
       _imageHeight = static_cast<unsigned int>(static_cast<double>(_imageWidth) / _aspectRatio);
       auto theta = _vfov * M_PI / 180.0;
-      auto focal = (_lookAt - _lookFrom).norm();
+      // the viewport is in the focus plane
+      auto focal = _focusDistance > 0.0 ? _focusDistance : (_lookAt - _lookFrom).norm();
       _vpHeight = 2 * tan(theta / 2.0) * focal;
       _vpWidth = _vpHeight * _aspectRatio;
 
@@ -168,7 +965,10 @@ class Camera {
       auto v = w ^ u;
       _cellOffsetRight = u * (_vpWidth / static_cast<double>(_imageWidth));
       _cellOffsetDown = v * (-_vpHeight / static_cast<double>(_imageHeight));
-      _vpCorner = _lookAt
+      _pixelSpread = _cellOffsetRight.norm() / focal;
+      _lensRight = u;
+      _lensUp = v;
+      _vpCorner = _lookFrom - w * focal
         + _cellOffsetRight * (-static_cast<double>(_imageWidth) / 2.0)
         + _cellOffsetDown * (-static_cast<double>(_imageHeight) / 2.0);
     }
@@ -189,7 +989,29 @@ class Camera {
     Vec3 _cellOffsetRight; // offset of one window cell (pixel) to the right
     Vec3 _cellOffsetDown; // offset of one window cell (pixel) below
     Vec3 _vpCorner; // position of the top left corner of the viewport 
-    unsigned int _cores;
+    double _pixelSpread; // angle of a pixel, spread of the cones of the camera rays
+    std::shared_ptr<ThreadPool> _pool;
+    std::vector<const Shape *> _replicas; // world of each NUMA node, or empty
     Vec3 _background1;
     Vec3 _background2;
+    double _shutterOpen; // time at which the shutter opens, in [0, 1]
+    double _shutterClose; // time at which the shutter closes, in [0, 1]
+    double _aperture; // diameter of the lens
+    double _focusDistance; // distance of the sharp plane, 0 for the distance to _lookAt
+    Vec3 _lensRight; // unit vectors of the plane of the lens
+    Vec3 _lensUp;
+    Integrator _integrator;
+    unsigned int _wavefrontBatchSize; // number of camera rays traced together by the wavefront integrator
+    bool _sortRays; // reorder the secondary rays in the wavefront integrator
+    unsigned int _packetSize; // size of the ray packets in the wavefront integrator
+    PostProcess _postProcess;
+    unsigned int _tileSize; // width and height of the tiles rendered by the threads
+    bool _denoise;
+    Denoiser _denoiser;
+    const EnvironmentMap *_environment; // sky, if not null
+    bool _sampleEnvironment; // next event estimation toward the environment
+    const LightBVH *_lights; // emissive shapes sampled by next event estimation, if not null
+    unsigned int _maxDepth; // maximum number of bounces
+    unsigned int _sceneFeatures; // features of the materials, see analyzeScene
+    bool _spectral; // trace wavelengths instead of RGB colors
 };
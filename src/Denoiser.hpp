@@ -0,0 +1,215 @@
+#pragma once
+
+#include <algorithm>
+#include <cmath>
+#include <limits>
+#include <vector>
+#include "Framebuffer.hpp"
+#include "Parallel.hpp"
+#include "Vec3.hpp"
+
+/**
+ *  Auxiliary buffers filled at the first hit of the camera rays, to
+ *  guide the denoiser: albedo (color of the material), normal and
+ *  distance to the camera. Each value is the average over a few
+ *  camera rays, such that the edges are antialiased.
+ */
+class FeatureBuffer {
+  public:
+    FeatureBuffer(unsigned int width, unsigned int height):
+      _w(width),
+      _h(height),
+      _albedos(3 * width * height, 0.0f),
+      _normals(3 * width * height, 0.0f),
+      _depths(width * height, 0.0f) {}
+
+    unsigned int width() const {return _w;}
+    unsigned int height() const {return _h;}
+
+    void set(unsigned int x, unsigned int y, const Vec3 &albedo, const Vec3 &normal, double depth) {
+      auto i = y * _w + x;
+      for (unsigned int c = 0; c < 3; ++c) {
+        _albedos[3 * i + c] = static_cast<float>(albedo[c]);
+        _normals[3 * i + c] = static_cast<float>(normal[c]);
+      }
+      _depths[i] = static_cast<float>(depth);
+    }
+
+    const float *getAlbedo(unsigned int i) const {return &_albedos[3 * i];}
+    const float *getNormal(unsigned int i) const {return &_normals[3 * i];}
+    float getDepth(unsigned int i) const {return _depths[i];}
+
+  private:
+    unsigned int _w;
+    unsigned int _h;
+    std::vector<float> _albedos;
+    std::vector<float> _normals;
+    std::vector<float> _depths;
+};
+
+/**
+ *  Edge-avoiding a-trous wavelet filter (Dammertz et al. 2010)
+ *
+ *  The illumination (color divided by the albedo, such that the
+ *  textures are not blurred) is filtered by several passes of a 5x5
+ *  B3-spline kernel whose taps are spread by 2^i pixels at pass i, so
+ *  that large footprints cost 25 taps per pass. Each tap is weighted by
+ *  the similarity of the normals, depths and colors of the two pixels.
+ *  The color tolerance is scaled down after each pass, and increased
+ *  by the variance of the pixels when the accumulation buffer stores it.
+ *  Passes are parallelized over the image rows.
+ */
+class Denoiser {
+  public:
+    Denoiser():
+      _iterations(5),
+      _colorSigma(0.2),
+      _normalSigma(0.3),
+      _depthSigma(0.01) {}
+    virtual ~Denoiser() {}
+
+    /**
+     *  Number of passes. The filter footprint is about 2^(iterations + 2) pixels
+     */
+    void setIterations(unsigned int iterations) {_iterations = iterations;}
+    /**
+     *  Tolerance on the color difference of the first pass. With 0 (as
+     *  for the other tolerances), only the equal values are mixed
+     */
+    void setColorSigma(double sigma) {_colorSigma = sigma;}
+    /**
+     *  Tolerance on the normal difference (norm of the difference of the unit normals)
+     */
+    void setNormalSigma(double sigma) {_normalSigma = sigma;}
+    /**
+     *  Tolerance on the depth difference, relative to the depth
+     */
+    void setDepthSigma(double sigma) {_depthSigma = sigma;}
+
+    /**
+     *  Replace the colors of the accumulation buffer by the filtered ones
+     *  (the sample counts are kept)
+     *  @param threads number of threads, or the ThreadPool running the passes
+     */
+    template<typename Threads>
+    void apply(AccumulationBuffer &buffer, const FeatureBuffer &features, Threads &&threads) const {
+      auto w = buffer.width();
+      auto h = buffer.height();
+      std::vector<float> illumination(3 * w * h);
+      std::vector<float> variances(w * h, 0.0f);
+      // demodulate the albedo
+      parallelFor(0, h, threads, [&](unsigned int y) {
+        for (unsigned int x = 0; x < w; ++x) {
+          auto i = y * w + x;
+          auto color = buffer.getAverage(x, y);
+          const float *albedo = features.getAlbedo(i);
+          for (unsigned int c = 0; c < 3; ++c) {
+            illumination[3 * i + c] = static_cast<float>(color[c]) / _demodulation(albedo[c]);
+          }
+          // variance of the mean of the samples
+          auto samples = buffer.getSamples(x, y);
+          if (samples) {
+            variances[i] = static_cast<float>(buffer.getVariance(x, y) / samples);
+          }
+        }
+      });
+      std::vector<float> temp(illumination.size());
+      for (unsigned int it = 0; it < _iterations; ++it) {
+        auto colorSigma2 = static_cast<float>(_colorSigma * _colorSigma / double(1 << it));
+        _pass(illumination, temp, variances, features, 1 << it, colorSigma2, threads);
+        std::swap(illumination, temp);
+      }
+      // remodulate and write back the sums
+      parallelFor(0, h, threads, [&](unsigned int y) {
+        float *row = buffer.getRow(y);
+        for (unsigned int x = 0; x < w; ++x) {
+          auto i = y * w + x;
+          auto samples = static_cast<float>(buffer.getSamples(x, y));
+          const float *albedo = features.getAlbedo(i);
+          for (unsigned int c = 0; c < 3; ++c) {
+            row[3 * x + c] = illumination[3 * i + c] * _demodulation(albedo[c]) * samples;
+          }
+        }
+      });
+    }
+
+  private:
+    static float _demodulation(float albedo) {
+      return std::max(albedo, 0.01f);
+    }
+
+    /**
+     *  One a-trous pass with taps spaced by step pixels
+     */
+    template<typename Threads>
+    void _pass(const std::vector<float> &input,
+        std::vector<float> &output,
+        const std::vector<float> &variances,
+        const FeatureBuffer &features,
+        int step,
+        float colorSigma2,
+        Threads &threads) const
+    {
+      static const float kernel[5] = {1.0f / 16.0f, 1.0f / 4.0f, 3.0f / 8.0f, 1.0f / 4.0f, 1.0f / 16.0f};
+      int w = static_cast<int>(features.width());
+      int h = static_cast<int>(features.height());
+      // a tolerance of 0 only mixes the equal values, instead of 0 / 0
+      auto normalSigma2 = static_cast<float>(_normalSigma * _normalSigma) + std::numeric_limits<float>::min();
+      auto depthSigma = static_cast<float>(_depthSigma);
+      parallelFor(0, static_cast<unsigned int>(h), threads, [&](unsigned int uy) {
+        int y = static_cast<int>(uy);
+        for (int x = 0; x < w; ++x) {
+          auto p = y * w + x;
+          const float *color = &input[3 * p];
+          const float *normal = features.getNormal(p);
+          float depth = features.getDepth(p);
+          float colorTolerance = colorSigma2 + variances[p] + std::numeric_limits<float>::min();
+          float depthTolerance = depthSigma * depth + std::numeric_limits<float>::min();
+          float sum[3] = {0.0f, 0.0f, 0.0f};
+          float weightSum = 0.0f;
+          for (int j = -2; j <= 2; ++j) {
+            int yy = y + j * step;
+            if (yy < 0 || yy >= h) {
+              continue;
+            }
+            for (int i = -2; i <= 2; ++i) {
+              int xx = x + i * step;
+              if (xx < 0 || xx >= w) {
+                continue;
+              }
+              auto q = yy * w + xx;
+              const float *otherColor = &input[3 * q];
+              const float *otherNormal = features.getNormal(q);
+              float colorDistance = 0.0f;
+              float normalDistance = 0.0f;
+              for (unsigned int c = 0; c < 3; ++c) {
+                auto dc = color[c] - otherColor[c];
+                auto dn = normal[c] - otherNormal[c];
+                colorDistance += dc * dc;
+                normalDistance += dn * dn;
+              }
+              float depthDistance = std::abs(depth - features.getDepth(q)) / depthTolerance;
+              float weight = kernel[i + 2] * kernel[j + 2] * std::exp(
+                  -colorDistance / colorTolerance
+                  - normalDistance / normalSigma2
+                  - depthDistance * depthDistance);
+              for (unsigned int c = 0; c < 3; ++c) {
+                sum[c] += otherColor[c] * weight;
+              }
+              weightSum += weight;
+            }
+          }
+          // weightSum > 0 thanks to the center tap
+          for (unsigned int c = 0; c < 3; ++c) {
+            output[3 * p + c] = sum[c] / weightSum;
+          }
+        }
+      });
+    }
+
+  private:
+    unsigned int _iterations;
+    double _colorSigma;
+    double _normalSigma;
+    double _depthSigma;
+};
@@ -0,0 +1,258 @@
+#pragma once
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <cstring>
+#include <fstream>
+#include <stdexcept>
+#include <string>
+#include <vector>
+#include "Texture.hpp"
+#include "Vec3.hpp"
+
+/**
+ *  HDR equirectangular environment map, used as the sky
+ *
+ *  The texel (x, y) covers the directions of azimuth phi = 2 pi u and
+ *  of polar angle theta = pi v (from the top) with u = (x + 0.5) / w,
+ *  v = (y + 0.5) / h.
+ *
+ *  Importance sampling: the map is divided into a grid of at most
+ *  512 x 256 buckets. The energy of each bucket (luminance weighted by
+ *  sin(theta), the area of the texels on the sphere) is read in O(1)
+ *  from a summed-area table, and a 2D CDF (marginal over the rows,
+ *  conditional within each row) selects a bucket in which the
+ *  direction is drawn uniformly. The density is piecewise constant,
+ *  so getPdf is also O(1).
+ *  Filtered lookups use a mip-map pyramid.
+ */
+class EnvironmentMap {
+  public:
+    /**
+     *  @param rgb linear radiances, RGB interleaved, rows from top to bottom
+     */
+    EnvironmentMap(unsigned int width, unsigned int height, std::vector<float> rgb, double intensity = 1.0):
+      _intensity(intensity)
+    {
+      _levels.push_back(Level{width, height, std::move(rgb)});
+      while (_levels.back().width > 1 || _levels.back().height > 1) {
+        _levels.push_back(_downsample(_levels.back()));
+      }
+      _buildDistribution();
+    }
+    EnvironmentMap(EnvironmentMap &&) = default;
+    virtual ~EnvironmentMap() {}
+
+    /**
+     *  Load a PFM (HDR) or PPM (LDR, in [0, 1]) file
+     */
+    static EnvironmentMap load(const std::string &path, double intensity = 1.0) {
+      std::ifstream is(path, std::ios::binary);
+      std::string format;
+      is >> format;
+      if (format == "P3" || format == "P6") {
+        unsigned int width, height;
+        auto ldr = TextureFile::readPPM(path, width, height);
+        std::vector<float> rgb(ldr.size());
+        for (size_t i = 0; i < ldr.size(); ++i) {
+          rgb[i] = ldr[i] / 255.0f;
+        }
+        return EnvironmentMap(width, height, std::move(rgb), intensity);
+      }
+      if (format != "PF") {
+        throw std::runtime_error("Unsupported environment map " + path);
+      }
+      unsigned int width, height;
+      double scale;
+      is >> width >> height >> scale;
+      is.get(); // single whitespace after the header
+      std::vector<float> rgb(3 * size_t(width) * height);
+      // the rows are stored from bottom to top
+      for (unsigned int y = 0; y < height; ++y) {
+        is.read(reinterpret_cast<char *>(&rgb[3 * size_t(height - 1 - y) * width]), 3 * width * sizeof(float));
+      }
+      if (!is) {
+        throw std::runtime_error("Truncated environment map " + path);
+      }
+      // scale < 0 for little endian data
+      const uint16_t one = 1;
+      bool littleEndianHost = *reinterpret_cast<const uint8_t *>(&one) == 1;
+      if ((scale < 0.0) != littleEndianHost) {
+        for (auto &value: rgb) {
+          uint8_t *bytes = reinterpret_cast<uint8_t *>(&value);
+          std::swap(bytes[0], bytes[3]);
+          std::swap(bytes[1], bytes[2]);
+        }
+      }
+      return EnvironmentMap(width, height, std::move(rgb), intensity * std::abs(scale));
+    }
+
+    /**
+     *  Radiance coming from a direction (unit vector)
+     *  @param lod level of detail, log2 of the footprint in texels
+     */
+    Vec3 getRadiance(const Vec3 &direction, double lod = 0.0) const {
+      double u, v;
+      getUV(direction, u, v);
+      auto level = static_cast<unsigned int>(std::max(0.0, std::min(lod + 0.5, double(_levels.size() - 1))));
+      return _getTexel(_levels[level], u, v) * _intensity;
+    }
+
+    /**
+     *  Level of detail of a cone of rays (see Ray::setCone)
+     *  @param spread angle of the cone, in radians
+     */
+    double getLod(double spread) const {
+      if (spread <= 0.0) {
+        return 0.0;
+      }
+      return std::log2(spread * _levels[0].width / (2.0 * M_PI));
+    }
+
+    /**
+     *  Draw a direction proportionally to the radiance
+     *  @return the radiance in this direction
+     */
+    Vec3 sample(Vec3 &direction, double &pdf) const {
+      if (_total <= 0.0) {
+        pdf = 0.0;
+        return Vec3();
+      }
+      auto row = _sampleCdf(&_marginal[0], _bucketsY, getRand(0.0, 1.0));
+      auto column = _sampleCdf(&_conditionals[row * (_bucketsX + 1)], _bucketsX, getRand(0.0, 1.0));
+      auto u = (column + getRand(0.0, 1.0)) / _bucketsX;
+      auto v = (row + getRand(0.0, 1.0)) / _bucketsY;
+      direction = getDirection(u, v);
+      pdf = _getPdf(column, row, v);
+      return _getTexel(_levels[0], u, v) * _intensity;
+    }
+
+    /**
+     *  Density (solid angle) with which sample draws direction
+     */
+    double getPdf(const Vec3 &direction) const {
+      if (_total <= 0.0) {
+        return 0.0;
+      }
+      double u, v;
+      getUV(direction, u, v);
+      auto column = std::min(_bucketsX - 1, static_cast<unsigned int>(u * _bucketsX));
+      auto row = std::min(_bucketsY - 1, static_cast<unsigned int>(v * _bucketsY));
+      return _getPdf(column, row, v);
+    }
+
+    static void getUV(const Vec3 &direction, double &u, double &v) {
+      u = 0.5 + atan2(direction[0], -direction[2]) / (2.0 * M_PI);
+      v = acos(std::max(-1.0, std::min(1.0, direction[1]))) / M_PI;
+    }
+
+    static Vec3 getDirection(double u, double v) {
+      auto phi = (u - 0.5) * 2.0 * M_PI;
+      auto theta = v * M_PI;
+      return Vec3(sin(theta) * sin(phi), cos(theta), -sin(theta) * cos(phi));
+    }
+
+  private:
+    struct Level {
+      unsigned int width;
+      unsigned int height;
+      std::vector<float> rgb;
+    };
+
+    static Level _downsample(const Level &level) {
+      Level res{std::max(1u, level.width / 2), std::max(1u, level.height / 2), {}};
+      res.rgb.resize(3 * size_t(res.width) * res.height);
+      for (unsigned int y = 0; y < res.height; ++y) {
+        for (unsigned int x = 0; x < res.width; ++x) {
+          auto x1 = std::min(level.width - 1, 2 * x + 1);
+          auto y1 = std::min(level.height - 1, 2 * y + 1);
+          for (unsigned int c = 0; c < 3; ++c) {
+            res.rgb[3 * (y * res.width + x) + c] = 0.25f * (
+                level.rgb[3 * (2 * y * level.width + 2 * x) + c] +
+                level.rgb[3 * (2 * y * level.width + x1) + c] +
+                level.rgb[3 * (y1 * level.width + 2 * x) + c] +
+                level.rgb[3 * (y1 * level.width + x1) + c]);
+          }
+        }
+      }
+      return res;
+    }
+
+    static Vec3 _getTexel(const Level &level, double u, double v) {
+      auto x = std::min(level.width - 1, static_cast<unsigned int>(u * level.width));
+      auto y = std::min(level.height - 1, static_cast<unsigned int>(v * level.height));
+      const float *p = &level.rgb[3 * (size_t(y) * level.width + x)];
+      return Vec3(p[0], p[1], p[2]);
+    }
+
+    /**
+     *  Summed-area table of the weighted luminance, then the bucket CDFs
+     */
+    void _buildDistribution() {
+      const auto &level = _levels[0];
+      auto w = level.width;
+      auto h = level.height;
+      // sat[y][x] = sum of the texels above and on the left of (x, y), exclusive
+      std::vector<double> sat(size_t(w + 1) * (h + 1), 0.0);
+      for (unsigned int y = 0; y < h; ++y) {
+        auto sinTheta = sin((y + 0.5) / h * M_PI);
+        double rowSum = 0.0;
+        for (unsigned int x = 0; x < w; ++x) {
+          const float *p = &level.rgb[3 * (size_t(y) * w + x)];
+          rowSum += (0.2126 * p[0] + 0.7152 * p[1] + 0.0722 * p[2]) * sinTheta;
+          sat[size_t(y + 1) * (w + 1) + x + 1] = sat[size_t(y) * (w + 1) + x + 1] + rowSum;
+        }
+      }
+      _bucketsX = std::min(w, 512u);
+      _bucketsY = std::min(h, 256u);
+      _marginal.assign(_bucketsY + 1, 0.0);
+      _conditionals.assign(size_t(_bucketsX + 1) * _bucketsY, 0.0);
+      for (unsigned int by = 0; by < _bucketsY; ++by) {
+        auto y0 = size_t(by) * h / _bucketsY;
+        auto y1 = size_t(by + 1) * h / _bucketsY;
+        double *cdf = &_conditionals[by * (_bucketsX + 1)];
+        for (unsigned int bx = 0; bx < _bucketsX; ++bx) {
+          auto x0 = size_t(bx) * w / _bucketsX;
+          auto x1 = size_t(bx + 1) * w / _bucketsX;
+          double energy = sat[y1 * (w + 1) + x1] - sat[y0 * (w + 1) + x1]
+            - sat[y1 * (w + 1) + x0] + sat[y0 * (w + 1) + x0];
+          // the average (not the sum) over the bucket, such that
+          // uneven bucket sizes do not skew the density
+          cdf[bx + 1] = cdf[bx] + std::max(0.0, energy) / double((x1 - x0) * (y1 - y0));
+        }
+        _marginal[by + 1] = _marginal[by] + cdf[_bucketsX];
+      }
+      _total = _marginal[_bucketsY];
+    }
+
+    /**
+     *  Index i such that cdf[i] <= r * cdf[n] < cdf[i + 1]
+     */
+    static unsigned int _sampleCdf(const double *cdf, unsigned int n, double r) {
+      auto target = r * cdf[n];
+      auto it = std::upper_bound(cdf + 1, cdf + n + 1, target);
+      return std::min(n - 1, static_cast<unsigned int>(it - cdf - 1));
+    }
+
+    double _getPdf(unsigned int column, unsigned int row, double v) const {
+      const double *cdf = &_conditionals[row * (_bucketsX + 1)];
+      // probability of the bucket, divided by its area in the (u, v) square
+      double pdfUV = (cdf[column + 1] - cdf[column]) / _total * _bucketsX * _bucketsY;
+      auto sinTheta = sin(v * M_PI);
+      if (sinTheta <= 0.0) {
+        return 0.0;
+      }
+      // dOmega = 2 pi^2 sin(theta) du dv
+      return pdfUV / (2.0 * M_PI * M_PI * sinTheta);
+    }
+
+  private:
+    double _intensity;
+    std::vector<Level> _levels; // mip-map, from the finest
+    unsigned int _bucketsX;
+    unsigned int _bucketsY;
+    std::vector<double> _marginal; // CDF of the rows of buckets, _bucketsY + 1 values
+    std::vector<double> _conditionals; // CDF of the buckets in each row, _bucketsX + 1 values per row
+    double _total;
+};
@@ -0,0 +1,210 @@
+#pragma once
+
+#include <algorithm>
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+#include <memory>
+#include <vector>
+#include "Vec3.hpp"
+
+/**
+ *  Array of T aligned on cache lines (and thus on SIMD registers)
+ */
+template<typename T>
+class AlignedArray {
+  public:
+    static const size_t alignment = 64;
+    AlignedArray(): _size(0) {}
+    explicit AlignedArray(size_t size): _size(size) {
+      // over-allocate and align manually
+      _raw.reset(new char[size * sizeof(T) + alignment]);
+      auto address = reinterpret_cast<uintptr_t>(_raw.get());
+      _data = reinterpret_cast<T *>((address + alignment - 1) / alignment * alignment);
+      std::memset(_data, 0, size * sizeof(T));
+    }
+    T *data() {return _data;}
+    const T *data() const {return _data;}
+    T &operator[](size_t i) {return _data[i];}
+    const T &operator[](size_t i) const {return _data[i];}
+    size_t size() const {return _size;}
+  private:
+    std::unique_ptr<char[]> _raw;
+    T *_data = nullptr;
+    size_t _size;
+};
+
+/**
+ *  Rectangular block of pixels rendered by one thread. The colors are
+ *  accumulated in the tile (which is private to the thread) and written
+ *  back once into the shared AccumulationBuffer, such that threads do
+ *  not write to the same cache lines during rendering.
+ */
+struct Tile {
+  Tile(): x0(0), y0(0), width(0), height(0), samples(0) {}
+
+  /**
+   *  Reset the tile for a new block of pixels
+   */
+  void reset(unsigned int tileX, unsigned int tileY, unsigned int tileWidth, unsigned int tileHeight) {
+    x0 = tileX;
+    y0 = tileY;
+    width = tileWidth;
+    height = tileHeight;
+    samples = 0;
+    colors.assign(3 * width * height, 0.0f);
+    squaredLuminances.assign(width * height, 0.0f);
+  }
+
+  /**
+   *  Add one sample (a color) to the pixel with local index i
+   */
+  void addSample(unsigned int i, const Vec3 &color) {
+    colors[3 * i] += static_cast<float>(color[0]);
+    colors[3 * i + 1] += static_cast<float>(color[1]);
+    colors[3 * i + 2] += static_cast<float>(color[2]);
+    auto luminance = static_cast<float>(getLuminance(color));
+    squaredLuminances[i] += luminance * luminance;
+  }
+
+  unsigned int size() const {return width * height;}
+
+  static double getLuminance(const Vec3 &color) {
+    return 0.2126 * color[0] + 0.7152 * color[1] + 0.0722 * color[2];
+  }
+
+  unsigned int x0; // position of the top left pixel in the image
+  unsigned int y0;
+  unsigned int width;
+  unsigned int height;
+  unsigned int samples; // number of samples per pixel
+  std::vector<float> colors; // sum of the sample colors, RGB interleaved
+  std::vector<float> squaredLuminances; // sum of the squared sample luminances
+};
+
+/**
+ *  Buffer accumulating the sum of the (linear, HDR) sample colors of
+ *  each pixel, in single precision (12 bytes per pixel). Optionally, it
+ *  also stores the number of samples per pixel (for progressive
+ *  rendering) and the sum of the squared luminances (to estimate the
+ *  variance). The rows are aligned on cache lines.
+ */
+class AccumulationBuffer {
+  public:
+    AccumulationBuffer(unsigned int width, unsigned int height,
+        bool withSampleCount = false,
+        bool withVariance = false):
+      _w(width),
+      _h(height),
+      _stride(_roundUp(3 * width)),
+      _colors(_stride * height),
+      _samples(0)
+    {
+      if (withSampleCount) {
+        _sampleCounts = AlignedArray<uint32_t>(width * height);
+      }
+      if (withVariance) {
+        _squaredLuminances = AlignedArray<float>(width * height);
+      }
+    }
+
+    unsigned int width() const {return _w;}
+    unsigned int height() const {return _h;}
+
+    /**
+     *  Add the samples of a tile
+     */
+    void addTile(const Tile &tile) {
+      for (unsigned int j = 0; j < tile.height; ++j) {
+        float *row = _colors.data() + (tile.y0 + j) * _stride + 3 * tile.x0;
+        const float *tileRow = &tile.colors[3 * j * tile.width];
+        for (unsigned int i = 0; i < 3 * tile.width; ++i) {
+          row[i] += tileRow[i];
+        }
+        auto offset = (tile.y0 + j) * _w + tile.x0;
+        if (_sampleCounts.size()) {
+          for (unsigned int i = 0; i < tile.width; ++i) {
+            _sampleCounts[offset + i] += tile.samples;
+          }
+        }
+        if (_squaredLuminances.size()) {
+          for (unsigned int i = 0; i < tile.width; ++i) {
+            _squaredLuminances[offset + i] += tile.squaredLuminances[j * tile.width + i];
+          }
+        }
+      }
+    }
+
+    /**
+     *  Without per-pixel sample counts, set the number of samples of all the pixels
+     */
+    void setSamplesPerPixel(unsigned int samples) {_samples = samples;}
+
+    /**
+     *  Number of samples accumulated in a pixel
+     */
+    unsigned int getSamples(unsigned int x, unsigned int y) const {
+      return _sampleCounts.size() ? _sampleCounts[y * _w + x] : _samples;
+    }
+
+    /**
+     *  Sum of the sample colors of a row, RGB interleaved
+     */
+    const float *getRow(unsigned int y) const {return _colors.data() + y * _stride;}
+    float *getRow(unsigned int y) {return _colors.data() + y * _stride;}
+
+    /**
+     *  Average color of a pixel
+     */
+    Vec3 getAverage(unsigned int x, unsigned int y) const {
+      auto samples = getSamples(x, y);
+      if (!samples) {
+        return Vec3();
+      }
+      const float *p = getRow(y) + 3 * x;
+      return Vec3(p[0], p[1], p[2]) / double(samples);
+    }
+
+    /**
+     *  Estimated variance of the luminance of the samples of a pixel
+     *  (0 if the buffer does not store the variance)
+     */
+    double getVariance(unsigned int x, unsigned int y) const {
+      auto samples = getSamples(x, y);
+      if (!_squaredLuminances.size() || samples < 2) {
+        return 0.0;
+      }
+      auto mean = Tile::getLuminance(getAverage(x, y));
+      auto meanSquare = _squaredLuminances[y * _w + x] / double(samples);
+      return std::max(0.0, (meanSquare - mean * mean) * samples / (samples - 1.0));
+    }
+
+    /**
+     *  Reset all the pixels to 0 samples
+     */
+    void clear() {
+      std::memset(_colors.data(), 0, _colors.size() * sizeof(float));
+      if (_sampleCounts.size()) {
+        std::memset(_sampleCounts.data(), 0, _sampleCounts.size() * sizeof(uint32_t));
+      }
+      if (_squaredLuminances.size()) {
+        std::memset(_squaredLuminances.data(), 0, _squaredLuminances.size() * sizeof(float));
+      }
+      _samples = 0;
+    }
+
+  private:
+    // round up a number of floats to a multiple of cache lines
+    static unsigned int _roundUp(unsigned int floats) {
+      unsigned int perLine = AlignedArray<float>::alignment / sizeof(float);
+      return (floats + perLine - 1) / perLine * perLine;
+    }
+
+    unsigned int _w;
+    unsigned int _h;
+    unsigned int _stride; // number of floats per row
+    AlignedArray<float> _colors;
+    AlignedArray<uint32_t> _sampleCounts; // empty if disabled
+    AlignedArray<float> _squaredLuminances; // empty if disabled
+    unsigned int _samples; // number of samples per pixel, without per-pixel counts
+};
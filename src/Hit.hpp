@@ -8,10 +8,18 @@
 
 struct Hit {
   Hit(): dist(std::numeric_limits<double>::max()),
+    frontFace(true),
+    u(0.0),
+    v(0.0),
+    footprint(0.0),
     shape(nullptr) {}
   Vec3 point;
-  Vec3 normal;
+  Vec3 normal; // unit normal, on the side of the ray origin
   double dist;
+  bool frontFace; // true if the ray hits the outer side of the surface
+  double u; // texture coordinates
+  double v;
+  double footprint; // width of the ray cone at the hit, in texture coordinates (0 for the finest detail)
   const Shape * shape;
 };
 
@@ -0,0 +1,310 @@
+#pragma once
+
+#include <algorithm>
+#include <cmath>
+#include <limits>
+#include <unordered_map>
+#include <vector>
+#include "Hit.hpp"
+#include "Vec3.hpp"
+#include "shapes/Shape.hpp"
+
+/**
+ *  Bounds of the light emitted by a group of emissive shapes: box,
+ *  cone of the normals of the surfaces and total power. The surfaces
+ *  emit on both sides (as in getRayColor), so the cone is used for the
+ *  normals and their opposites.
+ */
+struct LightBounds {
+  LightBounds(): power(0.0), cosTheta(1.0) {}
+
+  /**
+   *  Bounds of one emissive shape
+   */
+  explicit LightBounds(const Shape &shape) {
+    const auto &aabb = shape.getAABB();
+    for (unsigned int i = 0; i < 3; ++i) {
+      lower[i] = aabb.getInterval(i).min;
+      upper[i] = aabb.getInterval(i).max;
+    }
+    shape.getNormalBounds(axis, cosTheta);
+    // radiance of a point, times the area and the cosine weighted
+    // hemispheres of the two sides
+    Hit hit;
+    shape.samplePoint(0.5, 0.5, hit);
+    auto emission = shape.getMaterial().getEmission(hit);
+    auto luminance = 0.2126 * emission[0] + 0.7152 * emission[1] + 0.0722 * emission[2];
+    power = std::max(0.0, luminance) * shape.getArea() * 2.0 * M_PI;
+  }
+
+  void unionWith(const LightBounds &other) {
+    if (other.power <= 0.0) {
+      return;
+    }
+    if (power <= 0.0) {
+      *this = other;
+      return;
+    }
+    for (unsigned int i = 0; i < 3; ++i) {
+      lower[i] = std::min(lower[i], other.lower[i]);
+      upper[i] = std::max(upper[i], other.upper[i]);
+    }
+    _unionCones(other.axis, other.cosTheta);
+    power += other.power;
+  }
+
+  Vec3 getCenter() const {return (lower + upper) * 0.5;}
+
+  /**
+   *  Estimate of the light received at p from the group: power over
+   *  squared distance, times the cosine of the smallest angle between
+   *  the normals and the direction of p (Conty Estevez and Kulla 2018).
+   *  The normal at p is not used, such that the estimate only depends
+   *  on the position of the previous vertex of a path.
+   */
+  double getImportance(const Vec3 &p) const {
+    if (power <= 0.0) {
+      return 0.0;
+    }
+    auto center = getCenter();
+    auto toPoint = p - center;
+    auto d2 = toPoint.normSquare();
+    auto radius2 = (upper - lower).normSquare() / 4.0;
+    // avoid the infinite importance near the lights
+    d2 = std::max(d2, std::sqrt(radius2));
+    // angle between the axis and the direction of p
+    auto length2 = toPoint.normSquare();
+    auto cosW = length2 > 0.0 ? std::abs(axis * toPoint) / std::sqrt(length2) : 1.0;
+    cosW = std::min(1.0, cosW);
+    auto sinW = std::sqrt(std::max(0.0, 1.0 - cosW * cosW));
+    // minus the angle of the normals
+    auto sinO = std::sqrt(std::max(0.0, 1.0 - cosTheta * cosTheta));
+    auto cosX = _cosSubClamped(sinW, cosW, sinO, cosTheta);
+    auto sinX = std::sqrt(std::max(0.0, 1.0 - cosX * cosX));
+    // minus the angle under which the box is seen from p
+    double cosB = -1.0;
+    if (length2 > radius2) {
+      cosB = std::sqrt(std::max(0.0, 1.0 - radius2 / length2));
+    }
+    auto sinB = std::sqrt(std::max(0.0, 1.0 - cosB * cosB));
+    auto cosP = _cosSubClamped(sinX, cosX, sinB, cosB);
+    // the surfaces do not emit tangentially
+    if (cosP <= 0.0) {
+      return 0.0;
+    }
+    return power * cosP / d2;
+  }
+
+  Vec3 lower;
+  Vec3 upper;
+  Vec3 axis; // axis of the cone of normals
+  double power;
+  double cosTheta; // cosine of the half angle of the cone of normals
+
+private:
+  /**
+   *  cos(max(0, a - b)) from the sines and cosines of a and b
+   */
+  static double _cosSubClamped(double sinA, double cosA, double sinB, double cosB) {
+    if (cosA > cosB) {
+      return 1.0;
+    }
+    return cosA * cosB + sinA * sinB;
+  }
+
+  /**
+   *  Smallest cone containing this cone and another one
+   */
+  void _unionCones(const Vec3 &otherAxis, double otherCosTheta) {
+    if (cosTheta <= -1.0) {
+      return;
+    }
+    if (otherCosTheta <= -1.0) {
+      cosTheta = -1.0;
+      return;
+    }
+    auto thetaA = std::acos(std::max(-1.0, std::min(1.0, cosTheta)));
+    auto thetaB = std::acos(std::max(-1.0, std::min(1.0, otherCosTheta)));
+    auto thetaD = std::acos(std::max(-1.0, std::min(1.0, axis * otherAxis)));
+    if (std::min(thetaD + thetaB, M_PI) <= thetaA) {
+      return;
+    }
+    if (std::min(thetaD + thetaA, M_PI) <= thetaB) {
+      axis = otherAxis;
+      cosTheta = otherCosTheta;
+      return;
+    }
+    auto thetaO = (thetaA + thetaD + thetaB) / 2.0;
+    auto rotationAxis = axis ^ otherAxis;
+    if (thetaO >= M_PI || rotationAxis.normSquare() < 1e-12) {
+      cosTheta = -1.0;
+      return;
+    }
+    // rotate the axis toward the other one (Rodrigues formula)
+    rotationAxis.normalize();
+    auto angle = thetaO - thetaA;
+    axis = axis * std::cos(angle) + (rotationAxis ^ axis) * std::sin(angle)
+      + rotationAxis * ((rotationAxis * axis) * (1.0 - std::cos(angle)));
+    axis.normalize();
+    cosTheta = std::cos(thetaO);
+  }
+};
+
+/**
+ *  Hierarchy of the emissive shapes of a scene, to choose the light to
+ *  sample from a shading point with a probability proportional to its
+ *  estimated contribution (see LightBounds::getImportance).
+ *  Each node bounds the emission of its lights. A light is chosen by
+ *  descending from the root, picking a child with a probability
+ *  proportional to its importance, such that the cost and the noise
+ *  depend little on the number of lights, while picking the lights
+ *  uniformly would mostly draw distant or hidden ones.
+ */
+class LightBVH {
+  public:
+    explicit LightBVH(const std::vector<const Shape *> &lights): _lights(lights) {
+      for (unsigned int i = 0; i < _lights.size(); ++i) {
+        _indices[_lights[i]] = i;
+      }
+      _leaves.resize(_lights.size());
+      if (!_lights.empty()) {
+        std::vector<unsigned int> order(_lights.size());
+        std::vector<LightBounds> bounds;
+        for (unsigned int i = 0; i < _lights.size(); ++i) {
+          order[i] = i;
+          bounds.push_back(LightBounds(*_lights[i]));
+        }
+        _build(order, bounds, 0, static_cast<unsigned int>(order.size()), _none);
+      }
+    }
+
+    bool empty() const {return _lights.empty();}
+    unsigned int size() const {return static_cast<unsigned int>(_lights.size());}
+
+    /**
+     *  Choose a light to sample from the point p
+     *  @param u random number in [0, 1)
+     *  @param pmf probability of the chosen light
+     *  @return nullptr if no light reaches p
+     */
+    const Shape *sample(const Vec3 &p, double u, double &pmf) const {
+      pmf = 0.0;
+      if (_nodes.empty()) {
+        return nullptr;
+      }
+      unsigned int node = 0;
+      double probability = 1.0;
+      if (_nodes[0].bounds.getImportance(p) <= 0.0) {
+        return nullptr;
+      }
+      while (_nodes[node].light == _none) {
+        auto left = _nodes[node + 1].bounds.getImportance(p);
+        auto right = _nodes[_nodes[node].right].bounds.getImportance(p);
+        if (left + right <= 0.0) {
+          return nullptr;
+        }
+        auto pLeft = left / (left + right);
+        if (u < pLeft) {
+          u = std::min(u / pLeft, 1.0 - std::numeric_limits<double>::epsilon());
+          probability *= pLeft;
+          node = node + 1;
+        } else {
+          u = std::min((u - pLeft) / (1.0 - pLeft), 1.0 - std::numeric_limits<double>::epsilon());
+          probability *= 1.0 - pLeft;
+          node = _nodes[node].right;
+        }
+      }
+      pmf = probability;
+      return _lights[_nodes[node].light];
+    }
+
+    /**
+     *  Probability that sample chooses a shape from the point p (0 if
+     *  the shape is not a light of the hierarchy)
+     */
+    double getPmf(const Vec3 &p, const Shape *shape) const {
+      auto it = _indices.find(shape);
+      if (it == _indices.end()) {
+        return 0.0;
+      }
+      double pmf = 1.0;
+      auto node = _leaves[it->second];
+      if (_nodes[0].bounds.getImportance(p) <= 0.0) {
+        return 0.0;
+      }
+      // from the leaf up to the root
+      while (_nodes[node].parent != _none) {
+        auto parent = _nodes[node].parent;
+        auto left = _nodes[parent + 1].bounds.getImportance(p);
+        auto right = _nodes[_nodes[parent].right].bounds.getImportance(p);
+        if (left + right <= 0.0) {
+          return 0.0;
+        }
+        pmf *= (node == parent + 1 ? left : right) / (left + right);
+        node = parent;
+      }
+      return pmf;
+    }
+
+  private:
+    static const unsigned int _none = std::numeric_limits<unsigned int>::max();
+
+    /**
+     *  The nodes are stored in depth first order: the left child of a
+     *  node follows it
+     */
+    struct Node {
+      LightBounds bounds;
+      unsigned int right; // index of the right child
+      unsigned int light; // index of the light of a leaf, _none for the inner nodes
+      unsigned int parent;
+    };
+
+    /**
+     *  Build the subtree of the lights order[begin, end), split at the
+     *  median of the longest axis of their centers
+     */
+    unsigned int _build(std::vector<unsigned int> &order, const std::vector<LightBounds> &bounds,
+        unsigned int begin, unsigned int end, unsigned int parent) {
+      auto index = static_cast<unsigned int>(_nodes.size());
+      _nodes.push_back(Node{LightBounds(), _none, _none, parent});
+      if (end - begin == 1) {
+        _nodes[index].bounds = bounds[order[begin]];
+        _nodes[index].light = order[begin];
+        _leaves[order[begin]] = index;
+        return index;
+      }
+      Vec3 lower = bounds[order[begin]].getCenter();
+      Vec3 upper = lower;
+      for (unsigned int i = begin; i < end; ++i) {
+        auto center = bounds[order[i]].getCenter();
+        for (unsigned int a = 0; a < 3; ++a) {
+          lower[a] = std::min(lower[a], center[a]);
+          upper[a] = std::max(upper[a], center[a]);
+        }
+      }
+      auto extent = upper - lower;
+      unsigned int axis = 0;
+      for (unsigned int a = 1; a < 3; ++a) {
+        if (extent[a] > extent[axis]) {
+          axis = a;
+        }
+      }
+      auto middle = begin + (end - begin) / 2;
+      std::nth_element(order.begin() + begin, order.begin() + middle, order.begin() + end,
+          [&](unsigned int a, unsigned int b) {return bounds[a].getCenter()[axis] < bounds[b].getCenter()[axis];});
+      _build(order, bounds, begin, middle, index);
+      auto right = _build(order, bounds, middle, end, index);
+      _nodes[index].right = right;
+      auto nodeBounds = _nodes[index + 1].bounds;
+      nodeBounds.unionWith(_nodes[right].bounds);
+      _nodes[index].bounds = nodeBounds;
+      return index;
+    }
+
+  private:
+    std::vector<const Shape *> _lights;
+    std::unordered_map<const Shape *, unsigned int> _indices; // index of each light
+    std::vector<unsigned int> _leaves; // leaf of each light
+    std::vector<Node> _nodes;
+};
@@ -0,0 +1,92 @@
+#pragma once
+
+#include <cstdint>
+#include <cstring>
+#include <fstream>
+#include <mutex>
+#include <stdexcept>
+#include <string>
+#ifndef _WIN32
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+/**
+ *  Read-only file accessed by offset
+ *  On POSIX systems the file is memory-mapped, such that reading a
+ *  block only touches the pages of this block, and the system can
+ *  drop the pages when memory is needed (they are backed by the file).
+ *  Elsewhere, the blocks are read with a stream.
+ *  Reads are thread safe.
+ */
+class MappedFile {
+  public:
+    explicit MappedFile(const std::string &path):
+      _path(path),
+      _size(0),
+      _data(nullptr)
+    {
+#ifndef _WIN32
+      int fd = ::open(path.c_str(), O_RDONLY);
+      if (fd < 0) {
+        throw std::runtime_error("Cannot open " + path);
+      }
+      struct stat st;
+      if (fstat(fd, &st) == 0 && st.st_size > 0) {
+        _size = static_cast<size_t>(st.st_size);
+        void *data = mmap(nullptr, _size, PROT_READ, MAP_PRIVATE, fd, 0);
+        _data = (data == MAP_FAILED) ? nullptr : static_cast<const uint8_t *>(data);
+      }
+      ::close(fd);
+      if (!_data) {
+        throw std::runtime_error("Cannot map " + path);
+      }
+#else
+      _stream.open(path, std::ios::binary | std::ios::ate);
+      if (!_stream) {
+        throw std::runtime_error("Cannot open " + path);
+      }
+      _size = static_cast<size_t>(_stream.tellg());
+#endif
+    }
+    MappedFile(const MappedFile &) = delete;
+    MappedFile &operator=(const MappedFile &) = delete;
+
+    virtual ~MappedFile() {
+#ifndef _WIN32
+      if (_data) {
+        munmap(const_cast<uint8_t *>(_data), _size);
+      }
+#endif
+    }
+
+    /**
+     *  Copy size bytes starting at offset into output
+     */
+    void read(size_t offset, size_t size, void *output) const {
+      if (offset + size > _size) {
+        throw std::runtime_error("Read out of the bounds of " + _path);
+      }
+#ifndef _WIN32
+      std::memcpy(output, _data + offset, size);
+#else
+      std::lock_guard<std::mutex> lock(_mutex);
+      _stream.seekg(offset);
+      _stream.read(static_cast<char *>(output), size);
+#endif
+    }
+
+    size_t size() const {return _size;}
+    const std::string &path() const {return _path;}
+
+  private:
+    std::string _path;
+    size_t _size;
+    const uint8_t *_data; // mapped file, or null
+#ifdef _WIN32
+    mutable std::ifstream _stream;
+    mutable std::mutex _mutex;
+#endif
+};
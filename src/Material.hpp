@@ -1,24 +1,105 @@
 #pragma once
+#include <algorithm>
+#include <cmath>
+#include "Hit.hpp"
+#include "Texture.hpp"
 #include "Vec3.hpp"
 
 class Material {
     public:
-        Material(): _absorbtion(0.2), _reflection(0.0), _diffusion(0.3), _ambiant(0.5),
-            _color(1.0, 1.0, 1.0), _fuzz(0.0)  {
+        /**
+         *  Scattering model of the material, used to dispatch the BSDF
+         *  functions (see Bsdf.hpp) without virtual calls
+         *  Weighted: legacy model, weights of absorbtion, reflection,
+         *    diffusion and ambiant light
+         *  Lambertian: perfectly diffuse surface
+         *  Metal: GGX microfacet conductor
+         *  Dielectric: glass-like, reflects and refracts
+         *  Emissive: light source, does not scatter
+         *  Isotropic: particles of a participating medium, scatter
+         *    uniformly in all directions
+         */
+        enum class Type {
+          Weighted,
+          Lambertian,
+          Metal,
+          Dielectric,
+          Emissive,
+          Isotropic
+        };
+
+        Material(): _type(Type::Weighted), _absorbtion(0.2), _reflection(0.0), _diffusion(0.3), _ambiant(0.5),
+            _color(1.0, 1.0, 1.0), _fuzz(0.0), _roughness(0.0), _ior(1.0), _dispersion(0.0), _emission(0.0),
+            _texture(nullptr) {
         }
 
-        Material(double absorbtion, 
-            double reflection, 
-            double diffusion, 
-            double ambiant, 
-            const Vec3 &color): _color(color), _fuzz(0.0) {
+        Material(double absorbtion,
+            double reflection,
+            double diffusion,
+            double ambiant,
+            const Vec3 &color): _type(Type::Weighted), _color(color), _fuzz(0.0),
+            _roughness(0.0), _ior(1.0), _dispersion(0.0), _emission(0.0), _texture(nullptr) {
             double sum = absorbtion + reflection + diffusion + ambiant;
           _absorbtion = absorbtion / sum;
           _reflection = reflection / sum;
-          _diffusion = diffusion / sum;  
+          _diffusion = diffusion / sum;
           _ambiant = ambiant / sum;
         }
 
+        /**
+         *  Diffuse material reflecting a fraction albedo of the light
+         */
+        static Material lambertian(const Vec3 &albedo) {
+          Material material(Type::Lambertian, albedo);
+          return material;
+        }
+
+        /**
+         *  Conductor with GGX microfacets
+         *  @param color reflectance at normal incidence
+         *  @param roughness in [0, 1], 0 for a perfect mirror
+         */
+        static Material metal(const Vec3 &color, double roughness) {
+          Material material(Type::Metal, color);
+          material._roughness = std::max(0.0, std::min(roughness, 1.0));
+          return material;
+        }
+
+        /**
+         *  Smooth dielectric (glass, water...)
+         *  @param ior index of refraction (at 589 nm)
+         *  @param color attenuation of the refracted light
+         *  @param dispersion coefficient B of the Cauchy equation
+         *    n = A + B / lambda^2, in um^2 (0.0042 for BK7 glass, 0.013
+         *    for flint glass), only used by the spectral rendering
+         */
+        static Material dielectric(double ior, const Vec3 &color = Vec3(1.0, 1.0, 1.0), double dispersion = 0.0) {
+          Material material(Type::Dielectric, color);
+          material._ior = ior;
+          material._dispersion = dispersion;
+          return material;
+        }
+
+        /**
+         *  Light source emitting color * intensity
+         */
+        static Material emissive(const Vec3 &color, double intensity = 1.0) {
+          Material material(Type::Emissive, color);
+          material._emission = intensity;
+          return material;
+        }
+
+        /**
+         *  Particles of a volume (see Volume)
+         *  @param albedo probability of scattering at a collision, per channel
+         */
+        static Material isotropic(const Vec3 &albedo) {
+          Material material(Type::Isotropic, albedo);
+          return material;
+        }
+
+        Type getType() const {return _type;}
+
         void setFuzz(double fuzz) {_fuzz = std::min(fuzz, 1.0);}
         double getFuzz() const {return _fuzz;}
 
@@ -26,15 +107,90 @@ class Material {
         double getReflection() const {return _reflection;}
         double getDiffusion() const {return _diffusion;}
         double getAmbiant() const {return _ambiant;}
+        double getRoughness() const {return _roughness;}
+        double getIor() const {return _ior;}
+        double getDispersion() const {return _dispersion;}
+
+        /**
+         *  Index of refraction at a wavelength, in nm
+         */
+        double getIor(double wavelength) const {
+          auto micrometers = wavelength * 0.001;
+          return _ior + _dispersion * (1.0 / (micrometers * micrometers) - 1.0 / (0.5893 * 0.5893));
+        }
         const Vec3 &getColor() const {return _color;}
         void setColor(const Vec3 &color) {_color = color;}
         void multiplyColor(double v) {_color = _color * v;}
 
+        /**
+         *  Modulate the color by a texture (not owned), mapped with the
+         *  texture coordinates of the hits
+         */
+        void setTexture(const ImageTexture *texture) {_texture = texture;}
+        const ImageTexture *getTexture() const {return _texture;}
+
+        /**
+         *  Color at a hit point, with the texture if any, filtered over
+         *  the footprint of the hit. One of the two mip levels around
+         *  the footprint is drawn with the weight of the trilinear
+         *  filter, which the samples of the pixel average, such that
+         *  each lookup reads a single level.
+         */
+        Vec3 getColor(const Hit &hit) const {
+          if (!_texture) {
+            return _color;
+          }
+          auto lod = _texture->getLod(hit.footprint);
+          if (lod > 0.0) {
+            auto level = std::floor(lod);
+            lod = getRand() < lod - level ? level + 1.0 : level;
+          }
+          return _color.multiply(_texture->sample(hit.u, hit.v, lod));
+        }
+
+        /**
+         *  Light emitted by the surface at a hit point
+         */
+        Vec3 getEmission(const Hit &hit) const {
+          switch (_type) {
+            case Type::Weighted:
+              return getColor(hit) * _ambiant;
+            case Type::Emissive:
+              return getColor(hit) * _emission;
+            default:
+              return Vec3();
+          }
+        }
+
+        bool isEmissive() const {
+          return (_type == Type::Weighted && _ambiant > 0.0) || _type == Type::Emissive;
+        }
+
+        /**
+         *  Light source: emits and does not scatter. The weighted
+         *  materials that also scatter have an ambient glow rather than
+         *  a light, not worth sampling.
+         */
+        bool isLight() const {
+          return _type == Type::Emissive
+            || (_type == Type::Weighted && _ambiant > 0.0 && _reflection == 0.0 && _diffusion == 0.0);
+        }
+
     private:
+        Material(Type type, const Vec3 &color): _type(type), _absorbtion(0.0), _reflection(0.0),
+          _diffusion(0.0), _ambiant(0.0), _color(color), _fuzz(0.0), _roughness(0.0),
+          _ior(1.0), _dispersion(0.0), _emission(0.0), _texture(nullptr) {}
+
+        Type _type;
         double _absorbtion;
         double _reflection;
         double _diffusion;
         double _ambiant;
         Vec3 _color;
         double _fuzz;
+        double _roughness; // Metal
+        double _ior; // Dielectric
+        double _dispersion; // Dielectric, Cauchy coefficient in um^2
+        double _emission; // Emissive intensity
+        const ImageTexture *_texture;
 };
@@ -0,0 +1,230 @@
+#pragma once
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <limits>
+#include <vector>
+#include "Ray.hpp"
+#include "Vec3.hpp"
+
+/**
+ *  Participating medium (fog, smoke...), described by its extinction
+ *  coefficient (density) at each point
+ */
+class Medium {
+  public:
+    virtual ~Medium() {}
+
+    /**
+     *  Draw the distance to the next collision of the ray with the
+     *  particles of the medium, between tMin and tMax (delta tracking)
+     *  @return false if the ray reaches tMax without collision
+     */
+    virtual bool sampleCollision(const Ray &ray, double tMin, double tMax, double &t) const = 0;
+};
+
+/**
+ *  Medium of constant density: the free paths are drawn exactly
+ */
+class HomogeneousMedium : public Medium {
+  public:
+    explicit HomogeneousMedium(double density): _density(density) {}
+    virtual ~HomogeneousMedium() {}
+
+    virtual bool sampleCollision(const Ray &, double tMin, double tMax, double &t) const {
+      if (_density <= 0.0) {
+        return false;
+      }
+      t = tMin - std::log(1.0 - getRand(0.0, 1.0)) / _density;
+      return t < tMax;
+    }
+
+  private:
+    double _density;
+};
+
+/**
+ *  Heterogeneous medium defined by a voxel grid of densities
+ *
+ *  The voxels are grouped into bricks of 8x8x8 and only the bricks
+ *  containing a non-zero density are stored (sparse grid). Each brick
+ *  also has a majorant (its maximum density, 0 for the empty bricks).
+ *  Collisions are sampled by delta tracking while walking through the
+ *  bricks along the ray (3D DDA): in each brick, tentative collisions
+ *  are drawn with the brick majorant and accepted with probability
+ *  density / majorant, and the empty bricks are skipped without any
+ *  sample. The cost is thus proportional to the occupied volume
+ *  crossed by the ray, not to the size of the grid.
+ *  The density is constant within a voxel.
+ */
+class GridMedium : public Medium {
+  public:
+    static const unsigned int brickSize = 8;
+
+    /**
+     *  @param corner minimum corner of the grid
+     *  @param size extent of the grid
+     *  @param resolution number of voxels in each direction
+     */
+    GridMedium(const Vec3 &corner, const Vec3 &size, unsigned int nx, unsigned int ny, unsigned int nz):
+      _corner(corner),
+      _size(size),
+      _resolution{nx, ny, nz}
+    {
+      for (unsigned int i = 0; i < 3; ++i) {
+        _bricks[i] = (_resolution[i] + brickSize - 1) / brickSize;
+        _voxelSize[i] = _size[i] / _resolution[i];
+        _brickWorldSize[i] = _voxelSize[i] * brickSize;
+      }
+      auto count = size_t(_bricks[0]) * _bricks[1] * _bricks[2];
+      _brickIndices.assign(count, -1);
+      _majorants.assign(count, 0.0f);
+    }
+    virtual ~GridMedium() {}
+
+    /**
+     *  Set the density of a voxel. The bricks are allocated on demand.
+     */
+    void setDensity(unsigned int x, unsigned int y, unsigned int z, float density) {
+      auto brick = _getBrick(x / brickSize, y / brickSize, z / brickSize);
+      if (_brickIndices[brick] < 0) {
+        if (density <= 0.0f) {
+          return;
+        }
+        _brickIndices[brick] = static_cast<int32_t>(_densities.size() / (brickSize * brickSize * brickSize));
+        _densities.resize(_densities.size() + brickSize * brickSize * brickSize, 0.0f);
+      }
+      _densities[_getVoxel(brick, x, y, z)] = density;
+      _majorants[brick] = std::max(_majorants[brick], density);
+    }
+
+    /**
+     *  Set the densities of all the voxels from a function of the
+     *  position (evaluated at the voxel centers)
+     */
+    template<typename F>
+    void fill(F density) {
+      for (unsigned int z = 0; z < _resolution[2]; ++z) {
+        for (unsigned int y = 0; y < _resolution[1]; ++y) {
+          for (unsigned int x = 0; x < _resolution[0]; ++x) {
+            Vec3 p = _corner + Vec3((x + 0.5) * _voxelSize[0], (y + 0.5) * _voxelSize[1], (z + 0.5) * _voxelSize[2]);
+            auto d = static_cast<float>(density(p));
+            if (d > 0.0f) {
+              setDensity(x, y, z, d);
+            }
+          }
+        }
+      }
+    }
+
+    float getDensity(const Vec3 &p) const {
+      int v[3];
+      for (unsigned int i = 0; i < 3; ++i) {
+        v[i] = static_cast<int>(std::floor((p[i] - _corner[i]) / _voxelSize[i]));
+        if (v[i] < 0 || v[i] >= static_cast<int>(_resolution[i])) {
+          return 0.0f;
+        }
+      }
+      auto brick = _getBrick(v[0] / brickSize, v[1] / brickSize, v[2] / brickSize);
+      if (_brickIndices[brick] < 0) {
+        return 0.0f;
+      }
+      return _densities[_getVoxel(brick, v[0], v[1], v[2])];
+    }
+
+    /**
+     *  Number of stored bricks
+     */
+    size_t getBrickCount() const {return _densities.size() / (brickSize * brickSize * brickSize);}
+
+    virtual bool sampleCollision(const Ray &ray, double tMin, double tMax, double &t) const {
+      const auto &o = ray.origin();
+      const auto &d = ray.direction();
+      // clip to the grid
+      for (unsigned int i = 0; i < 3; ++i) {
+        if (d[i] == 0.0) {
+          if (o[i] < _corner[i] || o[i] > _corner[i] + _size[i]) {
+            return false;
+          }
+          continue;
+        }
+        auto t0 = (_corner[i] - o[i]) / d[i];
+        auto t1 = (_corner[i] + _size[i] - o[i]) / d[i];
+        tMin = std::max(tMin, std::min(t0, t1));
+        tMax = std::min(tMax, std::max(t0, t1));
+      }
+      if (tMin >= tMax) {
+        return false;
+      }
+      // DDA initialization, in brick units, from the entry point
+      int cell[3];
+      int step[3];
+      double next[3]; // value of t at which the ray crosses the next brick boundary
+      double delta[3]; // increment of t between two boundaries
+      auto entry = o + d * tMin;
+      for (unsigned int i = 0; i < 3; ++i) {
+        auto g = (entry[i] - _corner[i]) / _brickWorldSize[i];
+        cell[i] = std::min(static_cast<int>(_bricks[i]) - 1, std::max(0, static_cast<int>(std::floor(g))));
+        if (d[i] > 0.0) {
+          step[i] = 1;
+          delta[i] = _brickWorldSize[i] / d[i];
+          next[i] = tMin + ((cell[i] + 1) - g) * delta[i];
+        } else if (d[i] < 0.0) {
+          step[i] = -1;
+          delta[i] = -_brickWorldSize[i] / d[i];
+          next[i] = tMin + (g - cell[i]) * delta[i];
+        } else {
+          step[i] = 0;
+          delta[i] = std::numeric_limits<double>::infinity();
+          next[i] = std::numeric_limits<double>::infinity();
+        }
+      }
+      t = tMin;
+      while (t < tMax) {
+        unsigned int axis = next[0] < next[1] ? (next[0] < next[2] ? 0 : 2) : (next[1] < next[2] ? 1 : 2);
+        auto cellEnd = std::min(tMax, next[axis]);
+        auto majorant = _majorants[_getBrick(cell[0], cell[1], cell[2])];
+        if (majorant > 0.0f) {
+          while (true) {
+            t -= std::log(1.0 - getRand(0.0, 1.0)) / majorant;
+            if (t >= cellEnd) {
+              break;
+            }
+            // real collision, or null collision (continue)
+            if (getRand(0.0, majorant) < getDensity(o + d * t)) {
+              return true;
+            }
+          }
+        }
+        // the exponential distribution is memoryless: restart at the boundary
+        t = cellEnd;
+        cell[axis] += step[axis];
+        if (cell[axis] < 0 || cell[axis] >= static_cast<int>(_bricks[axis])) {
+          return false;
+        }
+        next[axis] += delta[axis];
+      }
+      return false;
+    }
+
+  private:
+    size_t _getBrick(unsigned int bx, unsigned int by, unsigned int bz) const {
+      return (size_t(bz) * _bricks[1] + by) * _bricks[0] + bx;
+    }
+
+    size_t _getVoxel(size_t brick, unsigned int x, unsigned int y, unsigned int z) const {
+      auto offset = size_t(_brickIndices[brick]) * brickSize * brickSize * brickSize;
+      return offset + ((z % brickSize) * brickSize + y % brickSize) * brickSize + x % brickSize;
+    }
+
+    Vec3 _corner;
+    Vec3 _size;
+    unsigned int _resolution[3]; // in voxels
+    unsigned int _bricks[3]; // number of bricks in each direction
+    double _voxelSize[3];
+    double _brickWorldSize[3];
+    std::vector<int32_t> _brickIndices; // index of each brick in _densities, -1 if empty
+    std::vector<float> _majorants; // maximum density of each brick
+    std::vector<float> _densities; // voxels of the allocated bricks
+};
@@ -0,0 +1,45 @@
+#pragma once
+
+#include <algorithm>
+#include <cstdint>
+#include "AABB.hpp"
+
+/**
+ *  Morton (Z-order) codes: interleaving the bits of the cell coordinates
+ *  gives an ordering in which points close in space are close in the order
+ */
+
+/**
+ *  Insert two zeros between each of the 10 lower bits of v
+ */
+inline uint32_t expandBits10(uint32_t v) {
+  v &= 0x3FF;
+  v = (v | (v << 16)) & 0x030000FF;
+  v = (v | (v << 8)) & 0x0300F00F;
+  v = (v | (v << 4)) & 0x030C30C3;
+  v = (v | (v << 2)) & 0x09249249;
+  return v;
+}
+
+/**
+ *  30 bits Morton code of a point, within a 1024^3 grid covering bounds
+ */
+inline uint32_t getMortonCode(const Vec3 &p, const AABB &bounds) {
+  uint32_t res = 0;
+  for (unsigned int i = 0; i < 3; ++i) {
+    auto interval = bounds.getSweptInterval(i);
+    auto size = interval.max - interval.min;
+    double relative = size > 0.0 ? (p[i] - interval.min) / size : 0.0;
+    relative = std::max(0.0, std::min(1.0, relative));
+    auto cell = static_cast<uint32_t>(relative * 1023.0);
+    res |= expandBits10(cell) << (2 - i);
+  }
+  return res;
+}
+
+/**
+ *  Octant (0 to 7) of a direction, from the signs of its components
+ */
+inline uint32_t getOctant(const Vec3 &direction) {
+  return (direction[0] < 0.0 ? 1 : 0) | (direction[1] < 0.0 ? 2 : 0) | (direction[2] < 0.0 ? 4 : 0);
+}
@@ -0,0 +1,67 @@
+#pragma once
+
+#include <thread>
+#include <vector>
+#include "ThreadPool.hpp"
+
+/**
+ *  Call f(i) for each i in [begin, end), splitting the range 
+ *  into contiguous chunks processed by threadsNumber threads
+ */
+template<typename F>
+void parallelFor(unsigned int begin, unsigned int end, unsigned int threadsNumber, F f) {
+  if (end <= begin) {
+    return;
+  }
+  unsigned int size = end - begin;
+  if (threadsNumber > size) {
+    threadsNumber = size;
+  }
+  if (threadsNumber <= 1) {
+    for (unsigned int i = begin; i < end; ++i) {
+      f(i);
+    }
+    return;
+  }
+  std::vector<std::thread> threads;
+  unsigned int chunkSize = size / threadsNumber;
+  for (unsigned int t = 0; t < threadsNumber; ++t) {
+    unsigned int start = begin + t * chunkSize;
+    unsigned int stop = (t == threadsNumber - 1) ? end : start + chunkSize;
+    threads.push_back(std::thread([&f, start, stop]() {
+      for (unsigned int i = start; i < stop; ++i) {
+        f(i);
+      }
+    }));
+  }
+  for (auto &thread: threads) {
+    thread.join();
+  }
+}
+
+/**
+ *  Call f(i) for each i in [begin, end), splitting the range into
+ *  contiguous chunks processed by the workers of a pool, without
+ *  starting threads. Must not be called from a task of the pool.
+ */
+template<typename F>
+void parallelFor(unsigned int begin, unsigned int end, ThreadPool &pool, F f) {
+  if (end <= begin) {
+    return;
+  }
+  unsigned long long size = end - begin;
+  unsigned long long workers = pool.size();
+  if (workers <= 1 || size == 1) {
+    for (unsigned int i = begin; i < end; ++i) {
+      f(i);
+    }
+    return;
+  }
+  pool.run([&](unsigned int worker) {
+    auto start = static_cast<unsigned int>(begin + size * worker / workers);
+    auto stop = static_cast<unsigned int>(begin + size * (worker + 1) / workers);
+    for (unsigned int i = start; i < stop; ++i) {
+      f(i);
+    }
+  });
+}
@@ -0,0 +1,201 @@
+#pragma once
+
+#include <algorithm>
+#include <cmath>
+#include <vector>
+#include "Framebuffer.hpp"
+#include "Image.hpp"
+#include "Parallel.hpp"
+
+/**
+ *  Post-processing of the rendered image, from the accumulation buffer
+ *  (linear color space) to the 8 bits display image.
+ *  The optional blur is a separable gaussian filter (one horizontal and
+ *  one vertical pass), and all the per-pixel operations (exposure, tone
+ *  mapping, gamma correction, clamping, quantization and conversion to
+ *  [0, 255]) are fused into a single pass. All the passes are
+ *  parallelized over the image rows, and the filters that are not
+ *  enabled are not run at all.
+ */
+class PostProcess {
+  public:
+    PostProcess():
+      _blurSigma(0.0),
+      _exposure(1.0),
+      _toneMapping(false),
+      _gamma(1.0),
+      _quantization(0) {}
+    virtual ~PostProcess() {}
+
+    /**
+     *  Gaussian blur with standard deviation sigma (in pixels). 0 to disable
+     */
+    void setBlur(double sigma) {_blurSigma = sigma;}
+    /**
+     *  Multiply the colors by exposure before the tone mapping
+     */
+    void setExposure(double exposure) {_exposure = exposure;}
+    /**
+     *  Map the colors from [0, inf) to [0, 1) with the Reinhard operator
+     *  instead of clamping them
+     */
+    void setToneMapping(bool toneMapping) {_toneMapping = toneMapping;}
+    /**
+     *  Gamma correction (2.0 is a square root). 1.0 to disable
+     */
+    void setGamma(double gamma) {_gamma = gamma;}
+    /**
+     *  Reduce the number of values per channel (cartoon effect). 0 to
+     *  disable, and above 256 it has no effect
+     */
+    void setQuantization(unsigned int colorValues) {_quantization = colorValues;}
+
+    /**
+     *  Average the samples of the accumulation buffer, apply the 
+     *  pipeline and write the result in the display image
+     *  @param threads number of threads, or the ThreadPool running the passes
+     */
+    template<typename Threads>
+    void apply(const AccumulationBuffer &input, Image &output, Threads &&threads) const {
+      auto w = input.width();
+      auto h = input.height();
+      if (_blurSigma > 0.0) {
+        std::vector<float> buffer(3 * w * h);
+        parallelFor(0, h, threads, [&](unsigned int y) {
+          _average(input, y, &buffer[3 * y * w]);
+        });
+        _blur(buffer, w, h, threads);
+        parallelFor(0, h, threads, [&](unsigned int y) {
+          _pointwise(&buffer[3 * y * w], output.getRow(y), 3 * w);
+        });
+      } else {
+        // no need for an intermediate image
+        parallelFor(0, h, threads, [&](unsigned int y) {
+          std::vector<float> row(3 * w);
+          _average(input, y, row.data());
+          _pointwise(row.data(), output.getRow(y), 3 * w);
+        });
+      }
+    }
+
+    /**
+     *  True if no filter mixes neighbour pixels, such that the tiles
+     *  can be converted independently with applyTile
+     */
+    bool isPointwise() const {return _blurSigma <= 0.0;}
+
+    /**
+     *  Average the samples of a rendered tile and apply the per-pixel
+     *  operations of the pipeline (not the blur)
+     *  @param output tile.width * tile.height RGB8 pixels
+     */
+    void applyTile(const Tile &tile, uint8_t *output) const {
+      float inv = tile.samples ? 1.0f / static_cast<float>(tile.samples) : 0.0f;
+      std::vector<float> values(tile.colors.size());
+      for (unsigned int i = 0; i < values.size(); ++i) {
+        values[i] = tile.colors[i] * inv;
+      }
+      _pointwise(values.data(), output, static_cast<unsigned int>(values.size()));
+    }
+
+  private:
+    /**
+     *  Average color of the pixels of a row
+     */
+    void _average(const AccumulationBuffer &input, unsigned int y, float *row) const {
+      const float *sums = input.getRow(y);
+      for (unsigned int x = 0; x < input.width(); ++x) {
+        auto samples = input.getSamples(x, y);
+        float inv = samples ? 1.0f / static_cast<float>(samples) : 0.0f;
+        row[3 * x] = sums[3 * x] * inv;
+        row[3 * x + 1] = sums[3 * x + 1] * inv;
+        row[3 * x + 2] = sums[3 * x + 2] * inv;
+      }
+    }
+
+    /**
+     *  Separable gaussian blur, with clamping at the borders
+     */
+    template<typename Threads>
+    void _blur(std::vector<float> &buffer, unsigned int w, unsigned int h, Threads &threads) const {
+      int radius = static_cast<int>(std::ceil(3.0 * _blurSigma));
+      // normalized weights, such that no division is needed per tap
+      std::vector<float> weights(2 * radius + 1);
+      float sum = 0.0f;
+      for (int i = -radius; i <= radius; ++i) {
+        weights[i + radius] = static_cast<float>(std::exp(-0.5 * i * i / (_blurSigma * _blurSigma)));
+        sum += weights[i + radius];
+      }
+      for (auto &weight: weights) {
+        weight /= sum;
+      }
+      std::vector<float> temp(buffer.size());
+      int iw = static_cast<int>(w);
+      int ih = static_cast<int>(h);
+      // horizontal pass
+      parallelFor(0, h, threads, [&](unsigned int y) {
+        const float *in = &buffer[3 * y * w];
+        float *out = &temp[3 * y * w];
+        for (int x = 0; x < iw; ++x) {
+          float r = 0.0f, g = 0.0f, b = 0.0f;
+          for (int i = -radius; i <= radius; ++i) {
+            int xx = std::min(iw - 1, std::max(0, x + i));
+            auto weight = weights[i + radius];
+            r += in[3 * xx] * weight;
+            g += in[3 * xx + 1] * weight;
+            b += in[3 * xx + 2] * weight;
+          }
+          out[3 * x] = r;
+          out[3 * x + 1] = g;
+          out[3 * x + 2] = b;
+        }
+      });
+      // vertical pass: the inner loop runs over contiguous values
+      parallelFor(0, h, threads, [&](unsigned int y) {
+        float *out = &buffer[3 * y * w];
+        std::fill(out, out + 3 * w, 0.0f);
+        for (int i = -radius; i <= radius; ++i) {
+          int yy = std::min(ih - 1, std::max(0, static_cast<int>(y) + i));
+          const float *in = &temp[3 * yy * w];
+          auto weight = weights[i + radius];
+          for (unsigned int j = 0; j < 3 * w; ++j) {
+            out[j] += in[j] * weight;
+          }
+        }
+      });
+    }
+
+    /**
+     *  All the per-value operations, fused, and conversion to 8 bits
+     */
+    void _pointwise(const float *values, uint8_t *output, unsigned int size) const {
+      auto exposure = static_cast<float>(_exposure);
+      auto invGamma = static_cast<float>(1.0 / _gamma);
+      auto chunk = std::max(1u, _quantization ? 256 / _quantization : 1);
+      for (unsigned int i = 0; i < size; ++i) {
+        auto v = values[i] * exposure;
+        if (_toneMapping) {
+          v = v / (1.0f + v);
+        }
+        // the spectral rendering can give slightly negative values
+        v = std::max(0.0f, std::min(1.0f, v));
+        if (_gamma == 2.0) {
+          v = std::sqrt(v);
+        } else if (_gamma != 1.0) {
+          v = std::pow(v, invGamma);
+        }
+        unsigned int q = static_cast<unsigned int>(v * 255.0f);
+        if (_quantization) {
+          q -= q % chunk;
+        }
+        output[i] = static_cast<uint8_t>(q);
+      }
+    }
+
+  private:
+    double _blurSigma;
+    double _exposure;
+    bool _toneMapping;
+    double _gamma;
+    unsigned int _quantization;
+};
@@ -0,0 +1,205 @@
+#pragma once
+
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstdio>
+#include <functional>
+#include <mutex>
+#include <string>
+#include <thread>
+#include "Camera.hpp"
+#include "Framebuffer.hpp"
+#include "Image.hpp"
+#include "shapes/Shape.hpp"
+
+/**
+ *  Interactive preview, to place the objects and the camera of a scene
+ *
+ *  A background thread renders the scene at a reduced resolution, one
+ *  sample per pixel at a time, and accumulates the passes as long as
+ *  nothing changes (progressive rendering). The frames are streamed to
+ *  a callback and/or a PPM file, replaced atomically such that a viewer
+ *  reloading it never sees a partial image.
+ *  Moving the camera or editing the scene cancels the current pass
+ *  before the next tile, and restarts the accumulation: only the
+ *  viewport is recomputed, the acceleration structures are kept.
+ *
+ *  Usage:
+ *    Preview preview(*scene->camera, scene->world);
+ *    preview.setOutput("preview.ppm");
+ *    preview.start();
+ *    preview.setView(lookFrom, lookAt, vfov);
+ *    preview.edit([&]() {material->...;});
+ */
+class Preview {
+  public:
+    /**
+     *  @param camera copied, with its settings (integrator, lens, post
+     *    processing...) and its resolution divided by scale
+     *  @param world not owned, must outlive the preview
+     */
+    Preview(const Camera &camera, const Shape &world, unsigned int scale = 4):
+      _camera(camera),
+      _world(world),
+      _maxPasses(1024),
+      _frameInterval(0.1),
+      _passes(0),
+      _dirty(true),
+      _stop(false),
+      _cancel(false),
+      _waiting(0)
+    {
+      _camera.setImageWidth(std::max(1u, camera.getImageWidth() / std::max(1u, scale)));
+      _camera.setRaysPerPixel(1);
+      _camera.update();
+    }
+    Preview(const Preview &) = delete;
+    Preview &operator=(const Preview &) = delete;
+
+    virtual ~Preview() {stop();}
+
+    /**
+     *  Write the frames to a PPM file
+     *  @param fps maximum number of frames written per second (the first
+     *    and last passes are always written)
+     */
+    void setOutput(const std::string &path, double fps = 10.0) {
+      edit([&]() {
+        _output = path;
+        _frameInterval = 1.0 / fps;
+      });
+    }
+
+    /**
+     *  Function called with each frame and its number of samples per
+     *  pixel, from the render thread (at the rate of setOutput)
+     */
+    void setCallback(std::function<void(const Image &, unsigned int)> callback) {
+      edit([&]() {_callback = std::move(callback);});
+    }
+
+    /**
+     *  Stop accumulating after this number of samples per pixel
+     */
+    void setMaxPasses(unsigned int maxPasses) {
+      edit([&]() {_maxPasses = maxPasses;});
+    }
+
+    void start() {
+      if (!_thread.joinable()) {
+        _stop = false;
+        _thread = std::thread(&Preview::_run, this);
+      }
+    }
+
+    void stop() {
+      if (_thread.joinable()) {
+        _cancel = true;
+        {
+          std::lock_guard<std::mutex> lock(_mutex);
+          _stop = true;
+        }
+        _condition.notify_all();
+        _thread.join();
+      }
+    }
+
+    /**
+     *  Move the camera and restart
+     */
+    void setView(const Vec3 &lookFrom, const Vec3 &lookAt, double vfov) {
+      edit([&]() {_camera.setView(lookFrom, lookAt, vfov);});
+    }
+
+    /**
+     *  Apply a change to the scene (materials, shapes...) while the
+     *  render thread is paused, then restart
+     */
+    void edit(const std::function<void()> &change) {
+      // the current pass stops at the end of its tiles, and the
+      // render thread waits for the change
+      ++_waiting;
+      _cancel = true;
+      {
+        std::lock_guard<std::mutex> lock(_mutex);
+        --_waiting;
+        change();
+        _dirty = true;
+      }
+      _condition.notify_all();
+    }
+
+    /**
+     *  Number of samples per pixel of the last frame
+     */
+    unsigned int getPasses() const {return _passes;}
+
+  private:
+    void _run() {
+      std::unique_lock<std::mutex> lock(_mutex);
+      AccumulationBuffer accumulation(0, 0);
+      auto lastFrame = std::chrono::steady_clock::now();
+      while (true) {
+        _condition.wait(lock, [this]() {return _stop || _dirty || _passes < _maxPasses;});
+        if (_stop) {
+          break;
+        }
+        if (_dirty) {
+          _camera.analyzeScene(_world);
+          _camera.update();
+          if (accumulation.width() != _camera.getImageWidth() || accumulation.height() != _camera.getImageHeight()) {
+            accumulation = AccumulationBuffer(_camera.getImageWidth(), _camera.getImageHeight());
+          } else {
+            accumulation.clear();
+          }
+          _passes = 0;
+          _dirty = false;
+          // another change may already be waiting
+          _cancel = _waiting > 0;
+        }
+        if (!_camera.renderTiles(_world, accumulation, nullptr, _passes, &_cancel)) {
+          // wait for the change that cancelled the pass
+          _condition.wait(lock, [this]() {return _stop || _dirty;});
+          continue;
+        }
+        ++_passes;
+        accumulation.setSamplesPerPixel(_passes);
+        auto now = std::chrono::steady_clock::now();
+        // the first pass after a change is shown at once
+        if (_passes == 1 || _passes == _maxPasses || std::chrono::duration<double>(now - lastFrame).count() >= _frameInterval) {
+          lastFrame = now;
+          _publish(accumulation);
+        }
+      }
+    }
+
+    void _publish(const AccumulationBuffer &accumulation) {
+      Image image(accumulation.width(), accumulation.height());
+      _camera.getPostProcess().apply(accumulation, image, _camera.getThreadPool());
+      if (_callback) {
+        _callback(image, _passes);
+      }
+      if (!_output.empty()) {
+        auto temporary = _output + ".tmp";
+        image.writePPM(temporary);
+        std::rename(temporary.c_str(), _output.c_str());
+      }
+    }
+
+  private:
+    Camera _camera; // copy at the preview resolution
+    const Shape &_world;
+    std::string _output;
+    std::function<void(const Image &, unsigned int)> _callback;
+    unsigned int _maxPasses;
+    double _frameInterval; // minimum time between two frames, in seconds
+    std::atomic<unsigned int> _passes; // samples per pixel accumulated since the last change
+    bool _dirty; // the view or the scene changed: restart the accumulation
+    bool _stop;
+    std::atomic<bool> _cancel;
+    std::atomic<unsigned int> _waiting; // number of changes waiting for the render thread
+    std::mutex _mutex; // held by the render thread, except while waiting
+    std::condition_variable _condition;
+    std::thread _thread;
+};
@@ -0,0 +1,63 @@
+#pragma once
+
+#include <cstdint>
+#include "Vec3.hpp"
+
+/**
+ *  Small and fast pseudo random number generator (xoshiro256+).
+ *  Unlike rand(), it has no global state: each thread or each task 
+ *  can own one, seeded such that the results are reproducible.
+ */
+class Random {
+public:
+  /**
+   *  Constructor
+   *  @param seed the global seed
+   *  @param stream an index to get independent sequences from one seed
+   *    (for instance, the index of a task)
+   */
+  Random(uint64_t seed = 0, uint64_t stream = 0) {
+    uint64_t s = seed ^ (stream * 0xD1342543DE82EF95ULL);
+    for (unsigned int i = 0; i < 4; ++i) {
+      _s[i] = _splitMix(s);
+    }
+  }
+
+  uint64_t next() {
+    auto res = _s[0] + _s[3];
+    auto t = _s[1] << 17;
+    _s[2] ^= _s[0];
+    _s[3] ^= _s[1];
+    _s[1] ^= _s[2];
+    _s[0] ^= _s[3];
+    _s[2] ^= t;
+    _s[3] = (_s[3] << 45) | (_s[3] >> 19);
+    return res;
+  }
+
+  /**
+   *  Uniform double in [mi, ma)
+   */
+  double getRand(double mi = 0.0, double ma = 1.0) {
+    // the 53 upper bits give a uniform double in [0, 1)
+    double u = static_cast<double>(next() >> 11) * (1.0 / 9007199254740992.0);
+    return mi + u * (ma - mi);
+  }
+
+  Vec3 getRandomVector(double min, double max) {
+    // explicit order of evaluation, for reproducibility
+    auto x = getRand(min, max);
+    auto y = getRand(min, max);
+    auto z = getRand(min, max);
+    return Vec3(x, y, z);
+  }
+
+private:
+  static uint64_t _splitMix(uint64_t &state) {
+    uint64_t z = (state += 0x9E3779B97F4A7C15ULL);
+    z = (z ^ (z >> 30)) * 0xBF58476D1CE4E5B9ULL;
+    z = (z ^ (z >> 27)) * 0x94D049BB133111EBULL;
+    return z ^ (z >> 31);
+  }
+  uint64_t _s[4];
+};
@@ -4,16 +4,42 @@
 
 class Ray {
   public: 
-    Ray(const Vec3 &origin, const Vec3 &direction): _o(origin), _d(direction) {
+    Ray(): _time(0.0), _width(0.0), _spread(0.0) {}
+    Ray(const Vec3 &origin, const Vec3 &direction, double time = 0.0): _o(origin), _d(direction), _time(time),
+      _width(0.0), _spread(0.0) {
       _d.normalize();
     }
     const Vec3 &origin() const {return _o;}
     const Vec3 &direction() const {return _d;}
+    // time at which the ray is cast, in [0, 1] (0 is the shutter opening)
+    double time() const {return _time;}
+
+    /**
+     *  Ray cone: isotropic ray differentials, the rays of the
+     *  neighbour pixels being at width + spread * distance from this
+     *  one. Selects the levels of detail of the textures and of the
+     *  geometry. 0 and 0 (the default) for an infinitely thin ray.
+     *  @param width at the origin
+     *  @param spread angle, in radians
+     */
+    void setCone(double width, double spread) {
+      _width = width;
+      _spread = spread;
+    }
+    double spread() const {return _spread;}
+
+    /**
+     *  Width of the cone at a distance from the origin
+     */
+    double getFootprint(double dist) const {return _width + _spread * dist;}
 
     friend std::ostream& operator<<(std::ostream &os, const Ray &ray) {
-      os << "(origin:" << ray.origin() << ", direction:" << ray.direction() << ")"; return os;
+      os << "(origin:" << ray.origin() << ", direction:" << ray.direction() << ", time:" << ray.time() << ")"; return os;
     }
   private:
     Vec3 _o;
     Vec3 _d;
+    double _time;
+    double _width; // of the cone at the origin
+    double _spread; // angle of the cone
 };
\ No newline at end of file
@@ -0,0 +1,286 @@
+#pragma once
+
+#include <chrono>
+#include <cmath>
+#include <cstdlib>
+#include <fstream>
+#include <functional>
+#include <iomanip>
+#include <iostream>
+#include <map>
+#include <memory>
+#include <string>
+#include <vector>
+#include "Image.hpp"
+#include "Scene.hpp"
+#include "Texture.hpp"
+#include "scenes/SceneCity.hpp"
+#include "scenes/SceneFramedMirror.hpp"
+#include "scenes/SceneMaterials.hpp"
+#include "scenes/SceneMotionBlur.hpp"
+#include "scenes/SceneParallelepipeds.hpp"
+
+/**
+ *  Golden image regression: renders each scene at a small resolution
+ *  with a fixed seed, and compares the images with the references
+ *  stored in a directory (<scene>.ppm, shared by the scenes that must
+ *  give the same image, such as the city in memory and out of core).
+ *
+ *  A scene fails if its image is too far from the reference. The
+ *  images are compared after averaging blocks of pixels, such that
+ *  changes of the noise (for instance another sampling order) pass but
+ *  a change of the mean (a broken material, a missing shape) fails.
+ *  The references are replaced with update, when a change of the
+ *  images is intended.
+ *
+ *  The time per sample of each scene is reported, and only checked
+ *  with setTiming: the timings depend on the machine and on the build,
+ *  and vary by tens of percents between runs, so they are compared
+ *  with a baseline recorded on the same machine, kept out of the
+ *  references.
+ *
+ *  The rendering uses a single thread, since the random numbers of
+ *  several threads interleave in a different order at each run.
+ *
+ *  Usage:
+ *    Regression regression("regression");
+ *    regression.setTiming("build/regression-baseline.txt"); // optional
+ *    bool ok = regression.run(std::cout);
+ */
+class Regression {
+  public:
+    typedef std::function<std::shared_ptr<Scene>(unsigned int, unsigned int, unsigned int)> SceneBuilder;
+
+    /**
+     *  @param directory directory of the reference images and baseline
+     */
+    Regression(const std::string &directory,
+        unsigned int imageWidth = 64,
+        unsigned int raysPerPixel = 64):
+      _directory(directory),
+      _imageWidth(imageWidth),
+      _raysPerPixel(raysPerPixel),
+      _seed(1),
+      _blockSize(8),
+      _tolerance(5.0),
+      _timeBudget(0.0),
+      _update(false)
+    {
+      addScene("parallelepipeds", [](unsigned int w, unsigned int spp, unsigned int cores) {
+        return createSceneParallelepiped(w, spp, cores);
+      });
+      addScene("fog", [](unsigned int w, unsigned int spp, unsigned int cores) {
+        return createSceneParallelepiped(w, spp, cores, true);
+      });
+      addScene("framedMirror", [](unsigned int w, unsigned int spp, unsigned int cores) {
+        return createSceneFramedMirror(w, spp, cores);
+      });
+      addScene("motionBlur", [](unsigned int w, unsigned int spp, unsigned int cores) {
+        return createSceneMotionBlur(w, spp, cores);
+      });
+      addScene("materials", [](unsigned int w, unsigned int spp, unsigned int cores) {
+        return createSceneMaterials(w, spp, cores, 0.5);
+      });
+      addScene("dispersion", [](unsigned int w, unsigned int spp, unsigned int cores) {
+        return createSceneMaterials(w, spp, cores, 0.0, 0.02);
+      });
+      addScene("city", [](unsigned int w, unsigned int spp, unsigned int cores) {
+        return createSceneCity(w, spp, cores, 4);
+      });
+      // the same city streamed from a geometry file (in the working
+      // directory) through a cache smaller than the file: the single
+      // precision of the file changes a few values, within the tolerance
+      addScene("cityOutOfCore", [](unsigned int w, unsigned int spp, unsigned int cores) {
+        return createSceneCity(w, spp, cores, 4, "regression-city.rtg", size_t(16) << 10);
+      }, "city");
+    }
+
+    /**
+     *  Add a scene to check (the scenes of the textures and of the
+     *  environment maps need image files, and are not included)
+     *  @param reference name of the reference image, if the scene must
+     *    give the same image as another one (which records it), the name
+     *    of the scene otherwise
+     */
+    void addScene(const std::string &name, SceneBuilder builder, const std::string &reference = "") {
+      _scenes.push_back(Entry{name, builder, reference.empty() ? name : reference});
+    }
+
+    /**
+     *  Maximum RMSE between the block averages of the image and of the
+     *  reference, in 8 bits values
+     */
+    void setTolerance(double tolerance) {_tolerance = tolerance;}
+
+    /**
+     *  Also check the time per sample of the scenes
+     *  @param baselinePath file of the timings of this machine, recorded
+     *    by the first run and by update
+     *  @param timeBudget maximum ratio between the time per sample and
+     *    the baseline
+     */
+    void setTiming(const std::string &baselinePath, double timeBudget = 1.5) {
+      _baselinePath = baselinePath;
+      _timeBudget = timeBudget;
+    }
+
+    /**
+     *  Record the images (and the timings, with setTiming) as the new
+     *  references instead of comparing them
+     */
+    void setUpdate(bool update) {_update = update;}
+
+    /**
+     *  Render and check all the scenes, and print a report
+     *  @return true if all the scenes pass
+     */
+    bool run(std::ostream &os) {
+      auto baseline = _readBaseline();
+      // first run of the timings on this machine
+      bool recordBaseline = _update || (!_baselinePath.empty() && baseline.empty());
+      bool ok = true;
+      os << std::left << std::setw(18) << "scene" << std::right
+        << std::setw(10) << "rmse" << std::setw(10) << "blocks"
+        << std::setw(12) << "ns/sample" << std::setw(12) << "baseline"
+        << std::setw(12) << "Msamples/s" << "  result" << std::endl;
+      for (auto &scene: _scenes) {
+        bool recordReference = _update && scene.reference == scene.name;
+        double nsPerSample = 0.0;
+        auto image = _render(scene.builder, nsPerSample);
+        auto reference = _directory + "/" + scene.reference + ".ppm";
+        double rmse = 0.0;
+        double blockRmse = 0.0;
+        std::string result = "ok";
+        if (recordBaseline) {
+          baseline[scene.name] = nsPerSample;
+        }
+        if (recordReference) {
+          image.writePPM(reference);
+          result = "updated";
+        } else if (!std::ifstream(reference)) {
+          result = "FAILED (no reference)";
+        } else {
+          unsigned int width, height;
+          auto rgb = TextureFile::readPPM(reference, width, height);
+          if (width != image.width() || height != image.height()) {
+            result = "FAILED (size)";
+          } else {
+            rmse = _getRmse(image, rgb, 1);
+            blockRmse = _getRmse(image, rgb, _blockSize);
+            if (blockRmse > _tolerance) {
+              result = "FAILED (image)";
+            }
+          }
+          auto it = baseline.find(scene.name);
+          if (!recordBaseline && it != baseline.end() && nsPerSample > it->second * _timeBudget) {
+            result = result == "ok" ? "FAILED (time)" : result + " (time)";
+          }
+        }
+        if (result.compare(0, 6, "FAILED") == 0) {
+          ok = false;
+        }
+        auto it = baseline.find(scene.name);
+        os << std::left << std::setw(18) << scene.name << std::right << std::fixed
+          << std::setprecision(2) << std::setw(10) << rmse << std::setw(10) << blockRmse
+          << std::setprecision(0) << std::setw(12) << nsPerSample
+          << std::setw(12) << (it == baseline.end() ? 0.0 : it->second)
+          << std::setprecision(3) << std::setw(12) << 1000.0 / nsPerSample
+          << "  " << result << std::endl;
+      }
+      if (recordBaseline && !_baselinePath.empty()) {
+        _writeBaseline(baseline);
+      }
+      os << (ok ? "All scenes passed" : "Regression detected") << std::endl;
+      return ok;
+    }
+
+  private:
+    struct Entry {
+      std::string name;
+      SceneBuilder builder;
+      std::string reference; // name of the reference image
+    };
+
+    /**
+     *  Render a scene with the fixed seed, and measure the best of three
+     *  renderings (to ignore the warm up of the caches)
+     */
+    Image _render(const SceneBuilder &builder, double &nsPerSample) const {
+      // some scenes place their shapes with getRand
+      srand(_seed);
+      auto scene = builder(_imageWidth, _raysPerPixel, 1);
+      scene->beforeRender();
+      auto &camera = *scene->camera;
+      Image image(0, 0);
+      double best = 0.0;
+      for (unsigned int i = 0; i < 3; ++i) {
+        srand(_seed);
+        auto start = std::chrono::steady_clock::now();
+        image = camera.renderImage(scene->world);
+        double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+        best = i == 0 ? seconds : std::min(best, seconds);
+      }
+      nsPerSample = best * 1e9 / (double(image.width()) * image.height() * _raysPerPixel);
+      return image;
+    }
+
+    /**
+     *  RMSE between the averages of the blocks of blockSize x blockSize
+     *  pixels of the image and of the reference
+     */
+    static double _getRmse(const Image &image, const std::vector<uint8_t> &reference, unsigned int blockSize) {
+      double sum = 0.0;
+      unsigned int count = 0;
+      for (unsigned int y0 = 0; y0 < image.height(); y0 += blockSize) {
+        for (unsigned int x0 = 0; x0 < image.width(); x0 += blockSize) {
+          for (unsigned int c = 0; c < 3; ++c) {
+            double difference = 0.0;
+            unsigned int pixels = 0;
+            for (unsigned int y = y0; y < std::min(y0 + blockSize, image.height()); ++y) {
+              for (unsigned int x = x0; x < std::min(x0 + blockSize, image.width()); ++x) {
+                difference += double(image(x, y)[c]) - reference[3 * (y * image.width() + x) + c];
+                ++pixels;
+              }
+            }
+            difference /= pixels;
+            sum += difference * difference;
+            ++count;
+          }
+        }
+      }
+      return std::sqrt(sum / count);
+    }
+
+    std::map<std::string, double> _readBaseline() const {
+      std::map<std::string, double> baseline;
+      if (_baselinePath.empty()) {
+        return baseline;
+      }
+      std::ifstream is(_baselinePath);
+      std::string name;
+      double nsPerSample;
+      while (is >> name >> nsPerSample) {
+        baseline[name] = nsPerSample;
+      }
+      return baseline;
+    }
+
+    void _writeBaseline(const std::map<std::string, double> &baseline) const {
+      std::ofstream os(_baselinePath);
+      for (auto &entry: baseline) {
+        os << entry.first << " " << entry.second << std::endl;
+      }
+    }
+
+  private:
+    std::string _directory;
+    std::vector<Entry> _scenes;
+    unsigned int _imageWidth;
+    unsigned int _raysPerPixel;
+    unsigned int _seed;
+    unsigned int _blockSize; // side of the blocks averaged before comparing the images
+    double _tolerance;
+    std::string _baselinePath; // timings of this machine, empty to not check them
+    double _timeBudget;
+    bool _update;
+};
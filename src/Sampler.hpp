@@ -0,0 +1,99 @@
+#pragma once
+
+#include <cmath>
+#include <cstdint>
+
+/**
+ *  Low-discrepancy samples of the camera rays of one pixel
+ *
+ *  The sample i of a pixel is the point i of the Halton sequence: one
+ *  prime base per dimension (pixel position, lens position, time,
+ *  wavelength).
+ *  All the dimensions of a sample come from the same index, so the
+ *  samples are stratified in each dimension and jointly: the lens
+ *  positions are spread over the aperture for every part of the pixel,
+ *  instead of being drawn independently of the pixel positions.
+ *  Each pixel shifts the sequence by its own random offset modulo 1
+ *  (Cranley-Patterson rotation), such that the neighbour pixels do not
+ *  share the same pattern, which would show as structured aliasing.
+ */
+class PixelSampler {
+  public:
+    /**
+     *  Dimensions of a camera sample
+     */
+    enum Dimension {
+      PixelX,
+      PixelY,
+      LensU,
+      LensV,
+      Time,
+      Wavelength,
+      DimensionCount
+    };
+
+    PixelSampler(unsigned int x, unsigned int y, uint32_t seed = 0) {
+      uint64_t state = (uint64_t(y) << 32 | x) ^ (uint64_t(seed) * 0x9E3779B97F4A7C15ULL);
+      for (unsigned int d = 0; d < DimensionCount; ++d) {
+        _offsets[d] = static_cast<double>(_hash(state) >> 11) * (1.0 / 9007199254740992.0);
+      }
+    }
+
+    /**
+     *  Coordinate of the sample in a dimension, in [0, 1)
+     */
+    double get(unsigned int index, Dimension dimension) const {
+      static const unsigned int bases[DimensionCount] = {2, 3, 5, 7, 11, 13};
+      auto value = _radicalInverse(bases[dimension], index) + _offsets[dimension];
+      return value >= 1.0 ? value - 1.0 : value;
+    }
+
+    /**
+     *  Map two coordinates in [0, 1) to the unit disk, without
+     *  distorting the strata (concentric mapping)
+     */
+    static void toDisk(double u, double v, double &x, double &y) {
+      u = 2.0 * u - 1.0;
+      v = 2.0 * v - 1.0;
+      if (u == 0.0 && v == 0.0) {
+        x = 0.0;
+        y = 0.0;
+        return;
+      }
+      double r, theta;
+      if (std::abs(u) > std::abs(v)) {
+        r = u;
+        theta = M_PI / 4.0 * (v / u);
+      } else {
+        r = v;
+        theta = M_PI / 2.0 - M_PI / 4.0 * (u / v);
+      }
+      x = r * cos(theta);
+      y = r * sin(theta);
+    }
+
+  private:
+    /**
+     *  Digits of index in base, mirrored around the radix point
+     */
+    static double _radicalInverse(unsigned int base, unsigned int index) {
+      double inverseBase = 1.0 / base;
+      double factor = inverseBase;
+      double res = 0.0;
+      while (index > 0) {
+        res += (index % base) * factor;
+        index /= base;
+        factor *= inverseBase;
+      }
+      return res;
+    }
+
+    static uint64_t _hash(uint64_t &state) {
+      uint64_t z = (state += 0x9E3779B97F4A7C15ULL);
+      z = (z ^ (z >> 30)) * 0xBF58476D1CE4E5B9ULL;
+      z = (z ^ (z >> 27)) * 0x94D049BB133111EBULL;
+      return z ^ (z >> 31);
+    }
+
+    double _offsets[DimensionCount]; // Cranley-Patterson rotation of each dimension
+};
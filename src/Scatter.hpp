@@ -0,0 +1,219 @@
+#pragma once
+
+#include <algorithm>
+#include <assert.h>
+#include <cmath>
+#include <cstdint>
+#include <functional>
+#include <unordered_map>
+#include <vector>
+#include "Parallel.hpp"
+#include "Random.hpp"
+#include "SphereCollisionManager.hpp"
+
+/**
+ *  A sphere placed by the SphereScatter
+ */
+struct ScatterCandidate {
+  Vec3 center;
+  double radius;
+  uint64_t index; // index of the candidate in the random sequence
+  Random rng; // generator to draw the other properties (color...) of the object
+};
+
+/**
+ *  Procedural scattering of non overlapping spheres
+ *
+ *  Candidates are generated in parallel, each with its own random
+ *  generator seeded from (seed, candidate index), and the collisions are
+ *  resolved in parallel with a grid of cells larger than the spheres
+ *  diameter: two cells that differ by at least two in one direction
+ *  cannot contain colliding spheres, so the cells are processed in eight
+ *  phases (one per parity of the cell coordinates) in which all cells are
+ *  independent. Within a cell, candidates are processed by increasing index.
+ *  The result only depends on the seed, not on the number of threads.
+ */
+class SphereScatter {
+public:
+  /**
+   *  Draw the center and the radius of a candidate
+   */
+  using Generator = std::function<void(Random &rng, Vec3 &center, double &radius)>;
+
+  /**
+   *  Constructor
+   *  @param maxRadius upper bound of the generated radiuses
+   *  @param seed the seed of the random generators
+   *  @param threads the number of threads
+   */
+  SphereScatter(double maxRadius, uint64_t seed, unsigned int threads):
+    _cellSize(2.0 * maxRadius),
+    _maxRadius(maxRadius),
+    _seed(seed),
+    _threads(threads) {}
+  virtual ~SphereScatter() {}
+
+  /**
+   *  Place count spheres that do not overlap with each other nor with
+   *  the obstacles. Stops earlier if the space is saturated.
+   *  @return the placed spheres, sorted by candidate index
+   */
+  std::vector<ScatterCandidate> scatter(unsigned int count,
+      const Generator &generator,
+      const SphereCollisionManager *obstacles = nullptr)
+  {
+    std::vector<ScatterCandidate> placed;
+    // all the placed spheres, per cell
+    CellMap cells;
+    uint64_t nextIndex = 0;
+    // the batch size only depends on count, for reproducibility
+    unsigned int batchSize = std::max(1024u, count);
+    unsigned int unsuccessfulRounds = 0;
+    while (placed.size() < count && unsuccessfulRounds < 16) {
+      auto batch = _generate(nextIndex, batchSize, generator, obstacles);
+      nextIndex += batchSize;
+      auto before = placed.size();
+      _resolve(batch, cells, placed);
+      unsuccessfulRounds = (placed.size() == before) ? unsuccessfulRounds + 1 : 0;
+    }
+    std::sort(placed.begin(), placed.end(),
+        [](const ScatterCandidate &c1, const ScatterCandidate &c2) {
+          return c1.index < c2.index;
+        });
+    if (placed.size() > count) {
+      // removing spheres does not create collisions
+      placed.resize(count);
+    }
+    return placed;
+  }
+
+private:
+  using CellMap = std::unordered_map<uint64_t, std::vector<ScatterCandidate> >;
+
+  /**
+   *  Generate a batch of candidates in parallel, and filter out
+   *  the ones colliding with the obstacles
+   */
+  std::vector<ScatterCandidate> _generate(uint64_t firstIndex,
+      unsigned int batchSize,
+      const Generator &generator,
+      const SphereCollisionManager *obstacles) const
+  {
+    std::vector<ScatterCandidate> batch(batchSize);
+    std::vector<char> valid(batchSize, 0);
+    parallelFor(0, batchSize, _threads, [&](unsigned int i) {
+      auto &candidate = batch[i];
+      candidate.index = firstIndex + i;
+      candidate.rng = Random(_seed, candidate.index);
+      generator(candidate.rng, candidate.center, candidate.radius);
+      assert(candidate.radius <= _maxRadius);
+      if (!obstacles || obstacles->canAddSphere(_toSphere(candidate))) {
+        valid[i] = 1;
+      }
+    });
+    std::vector<ScatterCandidate> res;
+    for (unsigned int i = 0; i < batchSize; ++i) {
+      if (valid[i]) {
+        res.push_back(batch[i]);
+      }
+    }
+    return res;
+  }
+
+  /**
+   *  Add the candidates that do not collide (with the already placed
+   *  spheres and with each other) to cells and placed
+   */
+  void _resolve(const std::vector<ScatterCandidate> &batch,
+      CellMap &cells,
+      std::vector<ScatterCandidate> &placed) const
+  {
+    if (batch.empty()) {
+      return;
+    }
+    // bin the candidates per cell, in index order
+    std::unordered_map<uint64_t, std::vector<const ScatterCandidate *> > bins;
+    std::vector<uint64_t> phaseCells[8];
+    for (auto &candidate: batch) {
+      int c[3];
+      _getCell(candidate.center, c);
+      auto key = _getKey(c[0], c[1], c[2]);
+      auto &bin = bins[key];
+      if (bin.empty()) {
+        phaseCells[(c[0] & 1) | ((c[1] & 1) << 1) | ((c[2] & 1) << 2)].push_back(key);
+        // create the cell now: no insertion in the map can happen
+        // while the threads read it
+        cells[key];
+      }
+      bin.push_back(&candidate);
+    }
+    for (unsigned int phase = 0; phase < 8; ++phase) {
+      auto &keys = phaseCells[phase];
+      parallelFor(0, static_cast<unsigned int>(keys.size()), _threads, [&](unsigned int i) {
+        auto &cell = cells.find(keys[i])->second;
+        for (auto candidate: bins.find(keys[i])->second) {
+          if (_canPlace(*candidate, cells)) {
+            cell.push_back(*candidate);
+          }
+        }
+      });
+    }
+    // collect the newly placed spheres
+    for (auto &bin: bins) {
+      auto &cell = cells.find(bin.first)->second;
+      for (auto &candidate: cell) {
+        if (candidate.index >= batch.front().index) {
+          placed.push_back(candidate);
+        }
+      }
+    }
+  }
+
+  /**
+   *  Check a candidate against the placed spheres in the neighbor cells
+   */
+  bool _canPlace(const ScatterCandidate &candidate, const CellMap &cells) const {
+    int c[3];
+    _getCell(candidate.center, c);
+    for (int x = c[0] - 1; x <= c[0] + 1; ++x) {
+      for (int y = c[1] - 1; y <= c[1] + 1; ++y) {
+        for (int z = c[2] - 1; z <= c[2] + 1; ++z) {
+          auto it = cells.find(_getKey(x, y, z));
+          if (it == cells.end()) {
+            continue;
+          }
+          for (auto &other: it->second) {
+            // same criterion as Sphere::intersect
+            auto d = (other.center - candidate.center).norm();
+            if (d < other.radius + candidate.radius) {
+              return false;
+            }
+          }
+        }
+      }
+    }
+    return true;
+  }
+
+  static Sphere _toSphere(const ScatterCandidate &candidate) {
+    static const Material material;
+    return Sphere(candidate.center, candidate.radius, material);
+  }
+
+  void _getCell(const Vec3 &p, int *c) const {
+    for (unsigned int i = 0; i < 3; ++i) {
+      c[i] = static_cast<int>(std::floor(p[i] / _cellSize));
+    }
+  }
+
+  static uint64_t _getKey(int x, int y, int z) {
+    const uint64_t mask = (1 << 21) - 1;
+    return ((uint64_t(x) & mask) << 42) | ((uint64_t(y) & mask) << 21) | (uint64_t(z) & mask);
+  }
+
+private:
+  double _cellSize;
+  double _maxRadius;
+  uint64_t _seed;
+  unsigned int _threads;
+};
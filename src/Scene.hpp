@@ -2,39 +2,89 @@
 
 #include "shapes/Shapes.hpp"
 #include "shapes/BVH.hpp"
+#include "Arena.hpp"
 #include "Camera.hpp"
+#include "LightBVH.hpp"
 #include "Material.hpp"
 #include "SphereCollisionManager.hpp"
+#include "Texture.hpp"
 
 
 struct Scene {
   Scene() {
   }
 
-  void addSmallShape(std::shared_ptr<Shape> shape) {
-    smallShapes.addShape(shape.get());
-    allShapes.push_back(shape);
+  /**
+   *  Construct an object (shape, material...) that lives as long as the scene
+   */
+  template<typename T, typename... Args>
+  T *create(Args&&... args) {
+    return arena.make<T>(std::forward<Args>(args)...);
   }
 
-  void addBigShape(std::shared_ptr<Shape> shape) {
-    world.addShape(shape.get());
-    allShapes.push_back(shape);
+  void addSmallShape(Shape *shape) {
+    smallShapes.addShape(shape);
+  }
+
+  void addBigShape(Shape *shape) {
+    world.addShape(shape);
   }
 
   void beforeRender() {
-    auto bvh = std::make_shared<BVH>(smallShapes.getShapes());
+    // emissive shapes, sampled toward by the camera
+    std::vector<const Shape *> lights;
+    world.getLights(lights);
+    smallShapes.getLights(lights);
+    if (!lights.empty()) {
+      this->lights = create<LightBVH>(lights);
+    }
+    bvh = create<BVH>(smallShapes.getShapes());
     addBigShape(bvh);
     world.addShape(&smallShapes);
+    if (camera) {
+      camera->analyzeScene(world);
+      camera->setLights(this->lights);
+    }
+  }
+
+  /**
+   *  On a machine with several NUMA nodes, build a copy of the BVH
+   *  and of the world on each node, with a thread of the node such that
+   *  the copy is in its memory. The threads of the camera then traverse
+   *  the copy of their node. The shapes themselves are shared.
+   *  To call after beforeRender.
+   */
+  void replicateWorld() {
+    auto &pool = camera->getThreadPool();
+    std::vector<const Shape *> replicas{&world};
+    for (unsigned int node = 1; node < pool.getNodeCount(); ++node) {
+      Shapes *replica = nullptr;
+      pool.runOnNode(node, [&]() {
+        // the arena allocates in chunks owned by the calling thread
+        replica = create<Shapes>();
+        for (auto shape: world.getShapes()) {
+          replica->addShape(shape == bvh ? create<BVH>(smallShapes.getShapes()) : shape);
+        }
+      });
+      replicas.push_back(replica);
+    }
+    camera->setWorldReplicas(pool.getNodeCount() > 1 ? replicas : std::vector<const Shape *>());
   }
 
+  // storage for all the objects of the scene, that
+  // are freed at once when the scene is destroyed
+  // (declared first to be destroyed last)
+  Arena arena;
+
   // the scene
   Shapes world;
   Shapes smallShapes;
+  BVH *bvh = nullptr; // of the small shapes
+  LightBVH *lights = nullptr; // of the emissive shapes, if any
   std::shared_ptr<Camera> camera; 
 
-  // buffers to keep a pointer to the objects that should
-  // not be deleted
-  std::vector<std::shared_ptr<Shape> > allShapes;
+  // tiles of the textures used by the materials
+  TextureCache textures;
+
   SphereCollisionManager collisionManager;
-  std::vector<std::shared_ptr<Material> > materials;
 };
@@ -0,0 +1,149 @@
+#pragma once
+
+#include <cmath>
+#include <cstdint>
+#include <unordered_map>
+#include <vector>
+#include "AABB.hpp"
+
+/**
+ *  Hash grid indexing axis aligned boxes, to find the boxes overlapping
+ *  a query box in O(1) expected time (for boxes of size comparable to
+ *  the cell size).
+ *  The boxes spanning too many cells (for instance a huge ground sphere)
+ *  are not hashed but stored in a separate list that is always checked.
+ *  Queries do not modify the structure, so they can run concurrently
+ *  (but not concurrently with insertions).
+ */
+class SpatialHash {
+public:
+  /**
+   *  Constructor
+   *  @param cellSize the size of the cubic cells. Should be of the order
+   *    of magnitude of the typical box size
+   *  @param maxCellsPerItem boxes covering more cells are not hashed
+   */
+  SpatialHash(double cellSize = 1.0, unsigned int maxCellsPerItem = 64):
+    _cellSize(cellSize),
+    _maxCellsPerItem(maxCellsPerItem) {}
+  virtual ~SpatialHash() {}
+
+  /**
+   *  Insert a box and return its index
+   */
+  unsigned int insert(const AABB &aabb) {
+    unsigned int index = static_cast<unsigned int>(_boxes.size());
+    _boxes.push_back(aabb);
+    CellRange range = _getRange(aabb);
+    if (range.cells() > _maxCellsPerItem) {
+      _large.push_back(index);
+      return index;
+    }
+    Entry entry{index, {range.min[0], range.min[1], range.min[2]}};
+    for (auto x = range.min[0]; x <= range.max[0]; ++x) {
+      for (auto y = range.min[1]; y <= range.max[1]; ++y) {
+        for (auto z = range.min[2]; z <= range.max[2]; ++z) {
+          _cells[_getKey(x, y, z)].push_back(entry);
+        }
+      }
+    }
+    return index;
+  }
+
+  /**
+   *  Call f(index) once for each inserted box overlapping aabb,
+   *  until f returns false.
+   *  @return false if f returned false
+   */
+  template<typename F>
+  bool query(const AABB &aabb, F f) const {
+    for (auto index: _large) {
+      if (_boxes[index].overlaps(aabb) && !f(index)) {
+        return false;
+      }
+    }
+    CellRange range = _getRange(aabb);
+    if (range.cells() > _cells.size()) {
+      // cheaper to check all the hashed boxes than all the cells
+      for (unsigned int index = 0; index < _boxes.size(); ++index) {
+        if (_isHashed(index) && _boxes[index].overlaps(aabb) && !f(index)) {
+          return false;
+        }
+      }
+      return true;
+    }
+    for (auto x = range.min[0]; x <= range.max[0]; ++x) {
+      for (auto y = range.min[1]; y <= range.max[1]; ++y) {
+        for (auto z = range.min[2]; z <= range.max[2]; ++z) {
+          auto it = _cells.find(_getKey(x, y, z));
+          if (it == _cells.end()) {
+            continue;
+          }
+          for (auto &entry: it->second) {
+            // a box covering several cells of the query range is only
+            // reported in the first cell of the intersection of the ranges
+            if (x != std::max(entry.minCell[0], range.min[0]) ||
+                y != std::max(entry.minCell[1], range.min[1]) ||
+                z != std::max(entry.minCell[2], range.min[2])) {
+              continue;
+            }
+            if (_boxes[entry.index].overlaps(aabb) && !f(entry.index)) {
+              return false;
+            }
+          }
+        }
+      }
+    }
+    return true;
+  }
+
+  const AABB &getBox(unsigned int index) const {return _boxes[index];}
+  unsigned int size() const {return static_cast<unsigned int>(_boxes.size());}
+
+private:
+  struct Entry {
+    unsigned int index;
+    int minCell[3]; // first cell covered by the box
+  };
+
+  struct CellRange {
+    int min[3];
+    int max[3];
+    double cells() const {
+      return double(max[0] - min[0] + 1) * double(max[1] - min[1] + 1) * double(max[2] - min[2] + 1);
+    }
+  };
+
+  CellRange _getRange(const AABB &aabb) const {
+    CellRange range;
+    for (unsigned int i = 0; i < 3; ++i) {
+      auto interval = aabb.getSweptInterval(i);
+      range.min[i] = _getCell(interval.min);
+      range.max[i] = _getCell(interval.max);
+    }
+    return range;
+  }
+
+  int _getCell(double v) const {
+    // clamp to avoid overflows with huge or infinite boxes
+    double cell = std::floor(v / _cellSize);
+    cell = std::max(-1e9, std::min(1e9, cell));
+    return static_cast<int>(cell);
+  }
+
+  static uint64_t _getKey(int x, int y, int z) {
+    const uint64_t mask = (1 << 21) - 1;
+    return ((uint64_t(x) & mask) << 42) | ((uint64_t(y) & mask) << 21) | (uint64_t(z) & mask);
+  }
+
+  bool _isHashed(unsigned int index) const {
+    return _getRange(_boxes[index]).cells() <= _maxCellsPerItem;
+  }
+
+private:
+  double _cellSize;
+  unsigned int _maxCellsPerItem;
+  std::unordered_map<uint64_t, std::vector<Entry> > _cells;
+  std::vector<unsigned int> _large; // boxes covering too many cells
+  std::vector<AABB> _boxes;
+};
@@ -0,0 +1,220 @@
+#pragma once
+
+#include <cmath>
+#include "Vec3.hpp"
+
+/**
+ *  Values of a spectral quantity (radiance, throughput) at the 4
+ *  wavelengths traced together by a path. The operations are plain
+ *  loops over the lanes, that the compiler turns into SIMD instructions.
+ */
+struct alignas(32) Spectrum {
+  static const unsigned int lanes = 4;
+
+  Spectrum(double value = 0.0) {
+    for (unsigned int i = 0; i < lanes; ++i) {
+      v[i] = value;
+    }
+  }
+
+  double &operator[](unsigned int i) {return v[i];}
+  double operator[](unsigned int i) const {return v[i];}
+
+  Spectrum &operator+=(const Spectrum &other) {
+    for (unsigned int i = 0; i < lanes; ++i) {
+      v[i] += other.v[i];
+    }
+    return *this;
+  }
+
+  Spectrum operator*(const Spectrum &other) const {
+    Spectrum res;
+    for (unsigned int i = 0; i < lanes; ++i) {
+      res.v[i] = v[i] * other.v[i];
+    }
+    return res;
+  }
+
+  Spectrum operator*(double factor) const {
+    Spectrum res;
+    for (unsigned int i = 0; i < lanes; ++i) {
+      res.v[i] = v[i] * factor;
+    }
+    return res;
+  }
+
+  double v[lanes];
+};
+
+/**
+ *  Wavelengths of a path, with hero wavelength sampling (Wilkie et al.
+ *  2014): the first one (the hero) is drawn uniformly over the visible
+ *  range, and the others are shifted by a quarter of the range each,
+ *  such that one path estimates 4 stratified wavelengths with a single
+ *  traversal of the scene.
+ *
+ *  The RGB colors of the scene (albedos, lights, sky) are upsampled to
+ *  smooth spectra, as combinations of 3 basis spectra (red, green and
+ *  blue bumps summing to 1), and the spectra are converted back to RGB
+ *  with the CIE 1931 matching functions. The conversion is normalized
+ *  such that the spectrum of an RGB color gives back this color: the
+ *  spectral and RGB renderings match, except where the wavelengths
+ *  differ (dispersion, products of colors along the paths).
+ */
+class Wavelengths {
+  public:
+    static constexpr double minWavelength = 380.0; // nm
+    static constexpr double maxWavelength = 720.0;
+
+    /**
+     *  @param u in [0, 1), position of the hero wavelength in the range
+     */
+    explicit Wavelengths(double u) {
+      const auto &tables = _getTables();
+      for (unsigned int i = 0; i < Spectrum::lanes; ++i) {
+        auto x = u + double(i) / Spectrum::lanes;
+        x = x >= 1.0 ? x - 1.0 : x;
+        _lambda[i] = minWavelength + x * (maxWavelength - minWavelength);
+        // linear interpolation in the tables of 1 nm steps
+        auto position = x * (_tableSize - 1);
+        auto index = std::min(static_cast<unsigned int>(position), _tableSize - 2);
+        auto t = position - index;
+        for (unsigned int c = 0; c < 3; ++c) {
+          _basis[c][i] = tables.basis[index][c] * (1.0 - t) + tables.basis[index + 1][c] * t;
+          _toRgb[c][i] = tables.toRgb[index][c] * (1.0 - t) + tables.toRgb[index + 1][c] * t;
+        }
+      }
+    }
+
+    double operator[](unsigned int i) const {return _lambda[i];}
+
+    /**
+     *  Values of the spectrum of an RGB color at the wavelengths
+     */
+    Spectrum fromRgb(const Vec3 &rgb) const {
+      Spectrum res;
+      for (unsigned int i = 0; i < Spectrum::lanes; ++i) {
+        res.v[i] = rgb[0] * _basis[0][i] + rgb[1] * _basis[1][i] + rgb[2] * _basis[2][i];
+      }
+      return res;
+    }
+
+    /**
+     *  RGB estimate of a spectrum from its values at the wavelengths
+     */
+    Vec3 toRgb(const Spectrum &spectrum) const {
+      double rgb[3] = {0.0, 0.0, 0.0};
+      for (unsigned int c = 0; c < 3; ++c) {
+        for (unsigned int i = 0; i < Spectrum::lanes; ++i) {
+          rgb[c] += _toRgb[c][i] * spectrum.v[i];
+        }
+      }
+      // uniform density over the range, 4 samples
+      auto factor = (maxWavelength - minWavelength) / Spectrum::lanes;
+      return Vec3(rgb[0], rgb[1], rgb[2]) * factor;
+    }
+
+    /**
+     *  Keep only the hero wavelength of the light reaching a path
+     *  through an event whose direction depends on the wavelength
+     *  (dispersion), since the other wavelengths would not follow the
+     *  same path. The hero is multiplied by the number of lanes, since
+     *  it now stands for all of them.
+     */
+    static Spectrum terminateSecondary(const Spectrum &spectrum) {
+      Spectrum res;
+      res.v[0] = spectrum.v[0] * Spectrum::lanes;
+      return res;
+    }
+
+  private:
+    static const unsigned int _tableSize = 341; // 1 nm steps
+
+    struct Tables {
+      double basis[_tableSize][3]; // red, green and blue basis spectra
+      double toRgb[_tableSize][3]; // linear sRGB weight of each wavelength
+    };
+
+    static const Tables &_getTables() {
+      static const Tables tables = _buildTables();
+      return tables;
+    }
+
+    static double _smoothstep(double edge0, double edge1, double x) {
+      auto t = std::max(0.0, std::min(1.0, (x - edge0) / (edge1 - edge0)));
+      return t * t * (3.0 - 2.0 * t);
+    }
+
+    /**
+     *  Piecewise gaussian of the fits of the CIE matching functions
+     */
+    static double _gaussian(double x, double mu, double sigma1, double sigma2) {
+      auto t = (x - mu) / (x < mu ? sigma1 : sigma2);
+      return std::exp(-0.5 * t * t);
+    }
+
+    static Tables _buildTables() {
+      Tables tables;
+      double rgbBar[_tableSize][3];
+      for (unsigned int i = 0; i < _tableSize; ++i) {
+        double lambda = minWavelength + i;
+        // smooth bumps, such that the spectra of the colors are smooth
+        auto blue = 1.0 - _smoothstep(470.0, 530.0, lambda);
+        auto red = _smoothstep(560.0, 620.0, lambda);
+        tables.basis[i][0] = red;
+        tables.basis[i][1] = 1.0 - red - blue;
+        tables.basis[i][2] = blue;
+        // CIE 1931 matching functions (Wyman et al. 2013 multi-lobe fit)
+        auto x = 1.056 * _gaussian(lambda, 599.8, 37.9, 31.0) + 0.362 * _gaussian(lambda, 442.0, 16.0, 26.7)
+          - 0.065 * _gaussian(lambda, 501.1, 20.4, 26.2);
+        auto y = 0.821 * _gaussian(lambda, 568.8, 46.9, 40.5) + 0.286 * _gaussian(lambda, 530.9, 16.3, 31.1);
+        auto z = 1.217 * _gaussian(lambda, 437.0, 11.8, 36.0) + 0.681 * _gaussian(lambda, 459.0, 26.0, 13.8);
+        // XYZ to linear sRGB
+        rgbBar[i][0] = 3.2406 * x - 1.5372 * y - 0.4986 * z;
+        rgbBar[i][1] = -0.9689 * x + 1.8758 * y + 0.0415 * z;
+        rgbBar[i][2] = 0.0557 * x - 0.2040 * y + 1.0570 * z;
+      }
+      // m[c][b]: RGB channel c of the basis spectrum b
+      // (trapezoidal integration over the range)
+      double m[3][3] = {};
+      for (unsigned int i = 0; i < _tableSize; ++i) {
+        double weight = (i == 0 || i == _tableSize - 1) ? 0.5 : 1.0;
+        for (unsigned int c = 0; c < 3; ++c) {
+          for (unsigned int b = 0; b < 3; ++b) {
+            m[c][b] += weight * rgbBar[i][c] * tables.basis[i][b];
+          }
+        }
+      }
+      // the weights m^-1 rgbBar map each basis spectrum to its channel
+      double inverse[3][3];
+      _invert(m, inverse);
+      for (unsigned int i = 0; i < _tableSize; ++i) {
+        for (unsigned int c = 0; c < 3; ++c) {
+          tables.toRgb[i][c] = 0.0;
+          for (unsigned int k = 0; k < 3; ++k) {
+            tables.toRgb[i][c] += inverse[c][k] * rgbBar[i][k];
+          }
+        }
+      }
+      return tables;
+    }
+
+    static void _invert(const double m[3][3], double inverse[3][3]) {
+      auto det = m[0][0] * (m[1][1] * m[2][2] - m[1][2] * m[2][1])
+        - m[0][1] * (m[1][0] * m[2][2] - m[1][2] * m[2][0])
+        + m[0][2] * (m[1][0] * m[2][1] - m[1][1] * m[2][0]);
+      for (unsigned int i = 0; i < 3; ++i) {
+        for (unsigned int j = 0; j < 3; ++j) {
+          // cofactor of (j, i)
+          auto a = m[(j + 1) % 3][(i + 1) % 3] * m[(j + 2) % 3][(i + 2) % 3];
+          auto b = m[(j + 1) % 3][(i + 2) % 3] * m[(j + 2) % 3][(i + 1) % 3];
+          inverse[i][j] = (a - b) / det;
+        }
+      }
+    }
+
+  private:
+    double _lambda[Spectrum::lanes];
+    double _basis[3][Spectrum::lanes]; // basis spectra at the wavelengths
+    double _toRgb[3][Spectrum::lanes]; // RGB weights of the wavelengths
+};
@@ -1,22 +1,32 @@
 #pragma once
 #include <vector>
 #include "shapes/Sphere.hpp"
+#include "SpatialHash.hpp"
 
+/**
+ *  Store non overlapping spheres and check if new spheres
+ *  collide with them. The spheres are indexed in a hash grid, 
+ *  such that a check costs O(1) instead of O(number of spheres).
+ */
 class SphereCollisionManager {
 public:
-  SphereCollisionManager() {}
+  /**
+   *  Constructor
+   *  @param cellSize size of the hash grid cells, typically the
+   *    diameter of the spheres to add
+   */
+  SphereCollisionManager(double cellSize = 1.0): _grid(cellSize) {}
   virtual ~SphereCollisionManager() {}
-  bool canAddSphere(std::shared_ptr<Sphere> sphere) {
-    for (auto sp: _spheres) {
-      if (sp->intersect(*sphere)) {
-        return false;
-      }
-    }
-    return true;
+  bool canAddSphere(const Sphere &sphere) const {
+    return _grid.query(sphere.getAABB(), [&](unsigned int index) {
+      return !_spheres[index]->intersect(sphere);
+    });
   }
-  void addSphere(std::shared_ptr<Sphere> sphere) {
+  void addSphere(const Sphere *sphere) {
+      _grid.insert(sphere->getAABB());
       _spheres.push_back(sphere);
   }
 private:
-  std::vector<std::shared_ptr<Sphere> >_spheres;
+  std::vector<const Sphere *>_spheres; // indexed like the boxes of _grid
+  SpatialHash _grid;
 };
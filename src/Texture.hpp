@@ -0,0 +1,444 @@
+#pragma once
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <cstring>
+#include <fstream>
+#include <limits>
+#include <list>
+#include <memory>
+#include <mutex>
+#include <stdexcept>
+#include <string>
+#include <unordered_map>
+#include <vector>
+#include <sys/stat.h>
+#include "MappedFile.hpp"
+#include "Vec3.hpp"
+
+/**
+ *  Tiled and mip-mapped texture file format (.rtt)
+ *
+ *  Header: 6 little endian uint32 (magic "RTT2", width, height, tile
+ *  size, number of levels, key of the source image), followed by the
+ *  levels from the finest to the coarsest. Each level is a row-major grid of square tiles of
+ *  tileSize x tileSize RGB8 texels (padded on the borders), so that any
+ *  tile can be located without an index and read in one block.
+ */
+class TextureFile {
+  public:
+    static const uint32_t magic = 0x32545452; // "RTT2"
+    static const size_t headerSize = 6 * sizeof(uint32_t);
+
+    /**
+     *  Write an RGB8 image, with its mip-map levels
+     *  @param key key of the source of the image (see getSourceKey), to
+     *    know if the file can be reused (see readKey)
+     */
+    static void write(const std::string &path, unsigned int width, unsigned int height,
+        const std::vector<uint8_t> &rgb, uint32_t key = 0, unsigned int tileSize = 64)
+    {
+      std::vector<std::vector<uint8_t> > levels{rgb};
+      std::vector<unsigned int> widths{width};
+      std::vector<unsigned int> heights{height};
+      while (widths.back() > 1 || heights.back() > 1) {
+        _downsample(levels.back(), widths.back(), heights.back(), levels, widths, heights);
+      }
+      std::ofstream os(path, std::ios::binary);
+      if (!os) {
+        throw std::runtime_error("Cannot write " + path);
+      }
+      uint32_t header[6] = {magic, width, height, tileSize, static_cast<uint32_t>(levels.size()), key};
+      os.write(reinterpret_cast<const char *>(header), sizeof(header));
+      std::vector<uint8_t> tile(3 * tileSize * tileSize);
+      for (unsigned int l = 0; l < levels.size(); ++l) {
+        auto w = widths[l];
+        auto h = heights[l];
+        for (unsigned int ty = 0; ty < getTileCount(h, tileSize); ++ty) {
+          for (unsigned int tx = 0; tx < getTileCount(w, tileSize); ++tx) {
+            for (unsigned int y = 0; y < tileSize; ++y) {
+              for (unsigned int x = 0; x < tileSize; ++x) {
+                // padding: repeat the border texels
+                auto sx = std::min(w - 1, tx * tileSize + x);
+                auto sy = std::min(h - 1, ty * tileSize + y);
+                std::memcpy(&tile[3 * (y * tileSize + x)], &levels[l][3 * (sy * w + sx)], 3);
+              }
+            }
+            os.write(reinterpret_cast<const char *>(tile.data()), tile.size());
+          }
+        }
+      }
+    }
+
+    /**
+     *  Convert a PPM image (P3 or P6, 8 bits) into a texture file
+     */
+    static void convertPPM(const std::string &ppm, const std::string &output, unsigned int tileSize = 64) {
+      unsigned int width, height;
+      auto rgb = readPPM(ppm, width, height);
+      write(output, width, height, rgb, getSourceKey(ppm), tileSize);
+    }
+
+    /**
+     *  Key of a source file, from its size and modification time (0 if
+     *  it does not exist), which changes when the file is edited
+     */
+    static uint32_t getSourceKey(const std::string &path) {
+      struct stat st;
+      if (stat(path.c_str(), &st) != 0) {
+        return 0;
+      }
+      auto key = (uint64_t(st.st_size) * 0x9E3779B97F4A7C15ULL) ^ uint64_t(st.st_mtime);
+#ifdef __linux__
+      // an edit within the same second as the conversion
+      key ^= uint64_t(st.st_mtim.tv_nsec) << 32;
+#endif
+      return static_cast<uint32_t>(key ^ (key >> 32));
+    }
+
+    /**
+     *  Key of the source of an existing texture file, false if there is
+     *  no file in the current format at path
+     */
+    static bool readKey(const std::string &path, uint32_t &key) {
+      std::ifstream is(path, std::ios::binary);
+      uint32_t header[6];
+      if (!is.read(reinterpret_cast<char *>(header), sizeof(header)) || header[0] != magic) {
+        return false;
+      }
+      key = header[5];
+      return true;
+    }
+
+    static std::vector<uint8_t> readPPM(const std::string &path, unsigned int &width, unsigned int &height) {
+      std::ifstream is(path, std::ios::binary);
+      std::string format;
+      unsigned int maxValue;
+      // the editors write comments between the values of the header
+      is >> format;
+      _skipComments(is);
+      is >> width;
+      _skipComments(is);
+      is >> height;
+      _skipComments(is);
+      is >> maxValue;
+      if (!is || (format != "P3" && format != "P6") || maxValue != 255) {
+        throw std::runtime_error("Unsupported image " + path);
+      }
+      std::vector<uint8_t> rgb(3 * width * height);
+      if (format == "P6") {
+        is.get(); // single whitespace after the header
+        is.read(reinterpret_cast<char *>(rgb.data()), rgb.size());
+      } else {
+        for (auto &value: rgb) {
+          unsigned int v;
+          is >> v;
+          value = static_cast<uint8_t>(v);
+        }
+      }
+      if (!is) {
+        throw std::runtime_error("Truncated image " + path);
+      }
+      return rgb;
+    }
+
+    static unsigned int getTileCount(unsigned int size, unsigned int tileSize) {
+      return (size + tileSize - 1) / tileSize;
+    }
+
+  private:
+    /**
+     *  Skip the whitespace and the comments (from # to the end of the
+     *  line) before the next value of a PPM header
+     */
+    static void _skipComments(std::istream &is) {
+      while ((is >> std::ws) && is.peek() == '#') {
+        is.ignore(std::numeric_limits<std::streamsize>::max(), '\n');
+      }
+    }
+
+    // 2x2 box filter
+    static void _downsample(const std::vector<uint8_t> &input, unsigned int w, unsigned int h,
+        std::vector<std::vector<uint8_t> > &levels,
+        std::vector<unsigned int> &widths,
+        std::vector<unsigned int> &heights)
+    {
+      auto nw = std::max(1u, w / 2);
+      auto nh = std::max(1u, h / 2);
+      std::vector<uint8_t> output(3 * nw * nh);
+      for (unsigned int y = 0; y < nh; ++y) {
+        for (unsigned int x = 0; x < nw; ++x) {
+          auto x0 = std::min(w - 1, 2 * x);
+          auto x1 = std::min(w - 1, 2 * x + 1);
+          auto y0 = std::min(h - 1, 2 * y);
+          auto y1 = std::min(h - 1, 2 * y + 1);
+          for (unsigned int c = 0; c < 3; ++c) {
+            unsigned int sum = input[3 * (y0 * w + x0) + c] + input[3 * (y0 * w + x1) + c]
+              + input[3 * (y1 * w + x0) + c] + input[3 * (y1 * w + x1) + c];
+            output[3 * (y * nw + x) + c] = static_cast<uint8_t>((sum + 2) / 4);
+          }
+        }
+      }
+      // push after reading input, which may be an element of levels
+      levels.push_back(std::move(output));
+      widths.push_back(nw);
+      heights.push_back(nh);
+    }
+};
+
+class TextureCache;
+
+/**
+ *  Texture stored in a .rtt file. The texels are not kept in memory:
+ *  the tiles are fetched through the TextureCache.
+ */
+class ImageTexture {
+  public:
+    ImageTexture(const std::string &path, uint32_t id, TextureCache &cache):
+      _file(path),
+      _id(id),
+      _cache(cache)
+    {
+      uint32_t header[6];
+      _file.read(0, sizeof(header), header);
+      if (header[0] != TextureFile::magic) {
+        throw std::runtime_error("Not a texture file: " + path);
+      }
+      _tileSize = header[3];
+      size_t offset = TextureFile::headerSize;
+      unsigned int w = header[1];
+      unsigned int h = header[2];
+      for (unsigned int l = 0; l < header[4]; ++l) {
+        Level level{w, h, TextureFile::getTileCount(w, _tileSize), offset};
+        _levels.push_back(level);
+        offset += getTileBytes() * level.tilesX * TextureFile::getTileCount(h, _tileSize);
+        w = std::max(1u, w / 2);
+        h = std::max(1u, h / 2);
+      }
+    }
+    virtual ~ImageTexture() {}
+
+    /**
+     *  Trilinear filtering with wrapping
+     *  @param lod level of detail, 0 for the full resolution and
+     *    log2(footprint in texels) otherwise
+     */
+    Vec3 sample(double u, double v, double lod = 0.0) const;
+
+    /**
+     *  Level of detail of a footprint in texture coordinates (see
+     *  Hit::footprint), isotropic
+     */
+    double getLod(double footprint) const {
+      if (footprint <= 0.0) {
+        return 0.0;
+      }
+      return std::log2(footprint * std::sqrt(double(width()) * height()));
+    }
+
+    /**
+     *  Color of one texel, in [0, 1]
+     */
+    Vec3 getTexel(unsigned int level, unsigned int x, unsigned int y) const;
+
+    /**
+     *  Read a tile from the file
+     */
+    void readTile(unsigned int level, unsigned int tx, unsigned int ty, uint8_t *output) const {
+      const auto &l = _levels[level];
+      _file.read(l.offset + (ty * l.tilesX + tx) * getTileBytes(), getTileBytes(), output);
+    }
+
+    uint32_t getId() const {return _id;}
+    unsigned int getTileSize() const {return _tileSize;}
+    size_t getTileBytes() const {return 3 * size_t(_tileSize) * _tileSize;}
+    unsigned int getLevels() const {return static_cast<unsigned int>(_levels.size());}
+    unsigned int width(unsigned int level = 0) const {return _levels[level].width;}
+    unsigned int height(unsigned int level = 0) const {return _levels[level].height;}
+
+  private:
+    Vec3 _bilinear(unsigned int level, double u, double v) const;
+
+    /**
+     *  Color of a texel of a tile, in [0, 1]
+     */
+    Vec3 _getTexel(const std::vector<uint8_t> &tile, unsigned int x, unsigned int y) const {
+      const uint8_t *rgb = &tile[3 * ((y % _tileSize) * _tileSize + x % _tileSize)];
+      return Vec3(rgb[0], rgb[1], rgb[2]) / 255.0;
+    }
+
+    struct Level {
+      unsigned int width;
+      unsigned int height;
+      unsigned int tilesX;
+      size_t offset; // of the first tile in the file
+    };
+
+    MappedFile _file;
+    uint32_t _id;
+    TextureCache &_cache;
+    unsigned int _tileSize;
+    std::vector<Level> _levels;
+};
+
+/**
+ *  Cache of texture tiles with a memory budget
+ *
+ *  The tiles are copied from the texture files on demand, and the least
+ *  recently used ones are evicted when the budget is exceeded, so that
+ *  scenes whose textures do not fit in memory can be rendered.
+ *  The cache is split into independent shards (each with its own lock,
+ *  LRU list and share of the budget) to limit the contention between
+ *  the rendering threads. A tile stays valid while a thread holds it,
+ *  even if it is evicted meanwhile, such that the lookups read several
+ *  texels of a tile with a single access to the cache.
+ */
+class TextureCache {
+  public:
+    /**
+     *  @param budget the maximum size of the cached tiles, in bytes
+     */
+    TextureCache(size_t budget = size_t(256) << 20): _budget(budget) {}
+    TextureCache(const TextureCache &) = delete;
+    TextureCache &operator=(const TextureCache &) = delete;
+    virtual ~TextureCache() {}
+
+    /**
+     *  Change the memory budget (applied at the next cache misses)
+     */
+    void setBudget(size_t budget) {_budget = budget;}
+
+    /**
+     *  Open a texture file (.rtt). A texture loaded twice is shared.
+     */
+    const ImageTexture *load(const std::string &path) {
+      std::lock_guard<std::mutex> lock(_texturesMutex);
+      for (auto &texture: _textures) {
+        if (texture.first == path) {
+          return texture.second.get();
+        }
+      }
+      auto id = static_cast<uint32_t>(_textures.size());
+      _textures.emplace_back(path, std::unique_ptr<ImageTexture>(new ImageTexture(path, id, *this)));
+      return _textures.back().second.get();
+    }
+
+    /**
+     *  RGB8 texels of a tile (see TextureFile), fetched if needed
+     */
+    std::shared_ptr<const std::vector<uint8_t> > getTile(const ImageTexture &texture, unsigned int level,
+        unsigned int tx, unsigned int ty) {
+      auto key = (uint64_t(texture.getId()) << 48) | (uint64_t(level) << 40) | (uint64_t(ty) << 20) | tx;
+      auto &shard = _shards[(key * 0x9E3779B97F4A7C15ULL) >> 60];
+      std::lock_guard<std::mutex> lock(shard.mutex);
+      auto it = shard.tiles.find(key);
+      if (it == shard.tiles.end()) {
+        it = _insert(shard, texture, key, level, tx, ty);
+      } else {
+        // most recently used first
+        shard.lru.splice(shard.lru.begin(), shard.lru, it->second.position);
+      }
+      return it->second.texels;
+    }
+
+    /**
+     *  Size of the cached tiles, in bytes
+     */
+    size_t getUsedBytes() const {
+      size_t res = 0;
+      for (auto &shard: _shards) {
+        std::lock_guard<std::mutex> lock(shard.mutex);
+        res += shard.used;
+      }
+      return res;
+    }
+
+  private:
+    static const unsigned int shardCount = 16;
+
+    struct Entry {
+      std::shared_ptr<const std::vector<uint8_t> > texels;
+      std::list<uint64_t>::iterator position; // in the LRU list
+    };
+
+    struct Shard {
+      mutable std::mutex mutex;
+      std::list<uint64_t> lru; // keys, most recently used first
+      std::unordered_map<uint64_t, Entry> tiles;
+      size_t used = 0;
+    };
+
+    std::unordered_map<uint64_t, Entry>::iterator _insert(Shard &shard,
+        const ImageTexture &texture,
+        uint64_t key,
+        unsigned int level,
+        unsigned int tx,
+        unsigned int ty)
+    {
+      auto bytes = texture.getTileBytes();
+      // evict, but always keep room for the requested tile
+      while (!shard.lru.empty() && shard.used + bytes > _budget / shardCount) {
+        auto evicted = shard.tiles.find(shard.lru.back());
+        shard.used -= evicted->second.texels->size();
+        shard.tiles.erase(evicted);
+        shard.lru.pop_back();
+      }
+      auto texels = std::make_shared<std::vector<uint8_t> >(bytes);
+      texture.readTile(level, tx, ty, texels->data());
+      Entry entry;
+      entry.texels = texels;
+      shard.lru.push_front(key);
+      entry.position = shard.lru.begin();
+      shard.used += bytes;
+      return shard.tiles.emplace(key, std::move(entry)).first;
+    }
+
+    size_t _budget;
+    Shard _shards[shardCount];
+    std::mutex _texturesMutex;
+    std::vector<std::pair<std::string, std::unique_ptr<ImageTexture> > > _textures;
+};
+
+inline Vec3 ImageTexture::getTexel(unsigned int level, unsigned int x, unsigned int y) const {
+  return _getTexel(*_cache.getTile(*this, level, x / _tileSize, y / _tileSize), x, y);
+}
+
+inline Vec3 ImageTexture::_bilinear(unsigned int level, double u, double v) const {
+  const auto &l = _levels[level];
+  // texel centers are at half integers
+  auto x = (u - std::floor(u)) * l.width - 0.5;
+  auto y = (v - std::floor(v)) * l.height - 0.5;
+  auto fx = std::floor(x);
+  auto fy = std::floor(y);
+  auto ax = x - fx;
+  auto ay = y - fy;
+  // wrap, x and y are in [-1, size)
+  auto x0 = static_cast<unsigned int>(fx < 0.0 ? l.width - 1 : fx);
+  auto y0 = static_cast<unsigned int>(fy < 0.0 ? l.height - 1 : fy);
+  auto x1 = (x0 + 1) % l.width;
+  auto y1 = (y0 + 1) % l.height;
+  // the 4 texels are in the same tile, but at the borders of the tiles
+  auto tx0 = x0 / _tileSize;
+  auto ty0 = y0 / _tileSize;
+  auto tx1 = x1 / _tileSize;
+  auto ty1 = y1 / _tileSize;
+  auto tile00 = _cache.getTile(*this, level, tx0, ty0);
+  auto tile10 = tx1 == tx0 ? tile00 : _cache.getTile(*this, level, tx1, ty0);
+  auto tile01 = ty1 == ty0 ? tile00 : _cache.getTile(*this, level, tx0, ty1);
+  auto tile11 = ty1 == ty0 ? tile10 : (tx1 == tx0 ? tile01 : _cache.getTile(*this, level, tx1, ty1));
+  return (_getTexel(*tile00, x0, y0) * (1.0 - ax) + _getTexel(*tile10, x1, y0) * ax) * (1.0 - ay)
+    + (_getTexel(*tile01, x0, y1) * (1.0 - ax) + _getTexel(*tile11, x1, y1) * ax) * ay;
+}
+
+inline Vec3 ImageTexture::sample(double u, double v, double lod) const {
+  auto maxLevel = static_cast<double>(_levels.size() - 1);
+  lod = std::max(0.0, std::min(lod, maxLevel));
+  auto level = static_cast<unsigned int>(lod);
+  auto t = lod - level;
+  auto res = _bilinear(level, u, v);
+  if (t > 0.0) {
+    res = res * (1.0 - t) + _bilinear(level + 1, u, v) * t;
+  }
+  return res;
+}
@@ -0,0 +1,291 @@
+#pragma once
+
+#include <algorithm>
+#include <condition_variable>
+#include <cstdlib>
+#include <exception>
+#include <fstream>
+#include <functional>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+#ifdef __linux__
+#include <dirent.h>
+#include <pthread.h>
+#include <sched.h>
+#endif
+
+/**
+ *  Persistent pool of worker threads, pinned to the cores
+ *
+ *  The workers are created once and wait for tasks, instead of
+ *  creating threads for each image. On Linux, each worker is pinned to
+ *  one core (among the cores allowed for the process), and the cores
+ *  are taken in turn from each NUMA node, such that a pool smaller than
+ *  the machine still uses the memory bandwidth of all the nodes. Since
+ *  a worker stays on its core, the memory it allocates and touches
+ *  first is placed on its node by the system (first touch policy), and
+ *  stays local.
+ *  Elsewhere, the workers are not pinned and there is a single node.
+ */
+class ThreadPool {
+  public:
+    /**
+     *  @param threads number of workers, 0 for one per available core
+     *  @param pin pin the workers to the cores
+     */
+    explicit ThreadPool(unsigned int threads = 0, bool pin = true):
+      _nodeCount(1),
+      _task(nullptr),
+      _generation(0),
+      _pending(0),
+      _stop(false)
+    {
+      auto cores = _getCores();
+      if (threads == 0) {
+        threads = static_cast<unsigned int>(cores.size());
+      }
+      for (auto &core: cores) {
+        _nodeCount = std::max(_nodeCount, core.node + 1);
+      }
+      for (unsigned int i = 0; i < threads; ++i) {
+        auto &core = cores[i % cores.size()];
+        _nodes.push_back(core.node);
+        _threads.push_back(std::thread(&ThreadPool::_work, this, i, pin ? core.id : -1));
+      }
+    }
+    ThreadPool(const ThreadPool &) = delete;
+    ThreadPool &operator=(const ThreadPool &) = delete;
+
+    virtual ~ThreadPool() {
+      {
+        std::lock_guard<std::mutex> lock(_mutex);
+        _stop = true;
+      }
+      _condition.notify_all();
+      for (auto &thread: _threads) {
+        thread.join();
+      }
+    }
+
+    /**
+     *  Pool shared by all the callers asking for the same number of
+     *  workers, created by the first one and destroyed with the last
+     *  one, such that the cameras of several scenes or views do not
+     *  each start and pin their own workers
+     *  @param threads number of workers, 0 for one per available core
+     */
+    static std::shared_ptr<ThreadPool> getShared(unsigned int threads = 0) {
+      static std::mutex mutex;
+      static std::map<unsigned int, std::weak_ptr<ThreadPool> > pools;
+      std::lock_guard<std::mutex> lock(mutex);
+      auto &shared = pools[threads];
+      auto pool = shared.lock();
+      if (!pool) {
+        pool = std::make_shared<ThreadPool>(threads);
+        shared = pool;
+      }
+      return pool;
+    }
+
+    unsigned int size() const {return static_cast<unsigned int>(_threads.size());}
+
+    unsigned int getNodeCount() const {return _nodeCount;}
+
+    /**
+     *  NUMA node of the core of a worker
+     */
+    unsigned int getNode(unsigned int worker) const {return _nodes[worker];}
+
+    /**
+     *  Call task(worker index) on all the workers, and wait until they
+     *  all return. The first exception thrown by a task (for instance a
+     *  corrupted file) is thrown again here. Concurrent calls are
+     *  serialized. Must not be called from a task.
+     */
+    void run(const std::function<void(unsigned int)> &task) {
+      std::lock_guard<std::mutex> runLock(_runMutex);
+      std::unique_lock<std::mutex> lock(_mutex);
+      _task = &task;
+      _pending = size();
+      ++_generation;
+      _condition.notify_all();
+      _done.wait(lock, [this]() {return _pending == 0;});
+      _task = nullptr;
+      auto exception = _exception;
+      _exception = nullptr;
+      lock.unlock();
+      if (exception) {
+        std::rethrow_exception(exception);
+      }
+    }
+
+    /**
+     *  Call task on one worker of a node (on the calling thread if the
+     *  node has no worker), and wait until it returns
+     */
+    void runOnNode(unsigned int node, const std::function<void()> &task) {
+      auto it = std::find(_nodes.begin(), _nodes.end(), node);
+      if (it == _nodes.end()) {
+        task();
+        return;
+      }
+      auto target = static_cast<unsigned int>(it - _nodes.begin());
+      run([&](unsigned int worker) {
+        if (worker == target) {
+          task();
+        }
+      });
+    }
+
+  private:
+    struct Core {
+      int id;
+      unsigned int node;
+    };
+
+    void _work(unsigned int index, int core) {
+#ifdef __linux__
+      if (core >= 0) {
+        cpu_set_t set;
+        CPU_ZERO(&set);
+        CPU_SET(core, &set);
+        pthread_setaffinity_np(pthread_self(), sizeof(set), &set);
+      }
+#else
+      (void)core;
+#endif
+      unsigned int generation = 0;
+      while (true) {
+        std::unique_lock<std::mutex> lock(_mutex);
+        _condition.wait(lock, [&]() {return _stop || _generation != generation;});
+        if (_stop) {
+          return;
+        }
+        generation = _generation;
+        auto task = _task;
+        lock.unlock();
+        std::exception_ptr exception;
+        try {
+          (*task)(index);
+        } catch (...) {
+          exception = std::current_exception();
+        }
+        lock.lock();
+        if (exception && !_exception) {
+          _exception = exception;
+        }
+        if (--_pending == 0) {
+          _done.notify_all();
+        }
+      }
+    }
+
+    /**
+     *  Cores available to the process, ordered by turns over the nodes
+     */
+    static std::vector<Core> _getCores() {
+      std::vector<std::vector<int> > coresByNode;
+#ifdef __linux__
+      cpu_set_t allowed;
+      CPU_ZERO(&allowed);
+      if (sched_getaffinity(0, sizeof(allowed), &allowed) == 0) {
+        // cores of each node, from /sys/devices/system/node/node<N>/cpulist
+        std::vector<int> nodeOfCore(CPU_SETSIZE, 0);
+        if (DIR *dir = opendir("/sys/devices/system/node")) {
+          while (dirent *entry = readdir(dir)) {
+            std::string name = entry->d_name;
+            if (name.size() <= 4 || name.compare(0, 4, "node") != 0
+                || name.find_first_not_of("0123456789", 4) != std::string::npos) {
+              continue;
+            }
+            int node = std::atoi(name.c_str() + 4);
+            std::ifstream is("/sys/devices/system/node/" + name + "/cpulist");
+            for (auto core: _parseList(is)) {
+              if (core >= 0 && core < CPU_SETSIZE) {
+                nodeOfCore[core] = node;
+              }
+            }
+          }
+          closedir(dir);
+        }
+        // nodes renumbered from 0 without gaps
+        std::vector<int> nodeIds;
+        for (int core = 0; core < CPU_SETSIZE; ++core) {
+          if (!CPU_ISSET(core, &allowed)) {
+            continue;
+          }
+          auto it = std::find(nodeIds.begin(), nodeIds.end(), nodeOfCore[core]);
+          if (it == nodeIds.end()) {
+            nodeIds.push_back(nodeOfCore[core]);
+            coresByNode.push_back({});
+            it = nodeIds.end() - 1;
+          }
+          coresByNode[it - nodeIds.begin()].push_back(core);
+        }
+      }
+#endif
+      std::vector<Core> cores;
+      if (coresByNode.empty()) {
+        for (unsigned int i = 0; i < std::max(1u, std::thread::hardware_concurrency()); ++i) {
+          cores.push_back(Core{-1, 0});
+        }
+        return cores;
+      }
+      for (size_t i = 0; cores.size() < _count(coresByNode); ++i) {
+        for (unsigned int node = 0; node < coresByNode.size(); ++node) {
+          if (i < coresByNode[node].size()) {
+            cores.push_back(Core{coresByNode[node][i], node});
+          }
+        }
+      }
+      return cores;
+    }
+
+    static size_t _count(const std::vector<std::vector<int> > &lists) {
+      size_t res = 0;
+      for (auto &list: lists) {
+        res += list.size();
+      }
+      return res;
+    }
+
+    /**
+     *  Parse a list of ranges such as "0-3,8,10-11" (empty for a node
+     *  without cores)
+     */
+    static std::vector<int> _parseList(std::istream &is) {
+      std::vector<int> res;
+      std::string range;
+      while (std::getline(is, range, ',')) {
+        // the trailing newline, or an empty list, would be read as core 0
+        if (range.find_first_of("0123456789") == std::string::npos) {
+          continue;
+        }
+        auto dash = range.find('-');
+        int first = std::atoi(range.c_str());
+        int last = dash == std::string::npos ? first : std::atoi(range.c_str() + dash + 1);
+        for (int i = first; i <= last; ++i) {
+          res.push_back(i);
+        }
+      }
+      return res;
+    }
+
+  private:
+    std::vector<std::thread> _threads;
+    std::vector<unsigned int> _nodes; // node of each worker
+    unsigned int _nodeCount;
+    const std::function<void(unsigned int)> *_task; // task of the current run
+    unsigned int _generation; // incremented for each run
+    unsigned int _pending; // number of workers still running the task
+    std::exception_ptr _exception; // first exception of the current run
+    bool _stop;
+    std::mutex _mutex;
+    std::mutex _runMutex;
+    std::condition_variable _condition; // a task or the destruction
+    std::condition_variable _done; // the last worker finished
+};
@@ -0,0 +1,186 @@
+#pragma once
+
+#include <algorithm>
+#include <condition_variable>
+#include <cstdint>
+#include <cstring>
+#include <deque>
+#include <fstream>
+#include <map>
+#include <mutex>
+#include <stdexcept>
+#include <string>
+#include <thread>
+#include <vector>
+#include "Texture.hpp"
+
+/**
+ *  Writes the finished tiles of an image to a file from a background
+ *  thread, such that the encoding and the I/O overlap the rendering,
+ *  and the whole image never needs to be in memory.
+ *
+ *  PPM: binary PPM (P6), written in scanline order. The tiles of a row
+ *  of tiles (a band) are buffered until the band is complete, then its
+ *  rows are appended. Since the threads render the tiles in row-major
+ *  order, only one or two bands are buffered at a time.
+ *  Tiled: texture file (.rtt, see TextureFile) with a single level, of
+ *  the tile size of the renderer: each tile is written at its own
+ *  offset as soon as it arrives.
+ */
+class TileWriter {
+  public:
+    enum class Format {
+      PPM,
+      Tiled
+    };
+
+    TileWriter(const std::string &path, unsigned int width, unsigned int height, unsigned int tileSize,
+        Format format = Format::PPM):
+      _width(width),
+      _tileSize(tileSize),
+      _format(format),
+      _tilesX(TextureFile::getTileCount(width, tileSize)),
+      _nextBand(0),
+      _bufferedBytes(0),
+      _maxBufferedBytes(0),
+      _finished(false),
+      _os(path, std::ios::binary)
+    {
+      if (!_os) {
+        throw std::runtime_error("Cannot write " + path);
+      }
+      if (_format == Format::PPM) {
+        _os << "P6\n" << width << " " << height << "\n255\n";
+      } else {
+        uint32_t header[6] = {TextureFile::magic, width, height, tileSize, 1, 0};
+        _os.write(reinterpret_cast<const char *>(header), sizeof(header));
+      }
+      _headerSize = static_cast<size_t>(_os.tellp());
+      _thread = std::thread(&TileWriter::_run, this);
+    }
+    TileWriter(const TileWriter &) = delete;
+    TileWriter &operator=(const TileWriter &) = delete;
+
+    virtual ~TileWriter() {finish();}
+
+    /**
+     *  Queue a finished tile (thread safe)
+     *  @param rgb width * height RGB8 pixels, moved
+     */
+    void push(unsigned int x0, unsigned int y0, unsigned int width, unsigned int height, std::vector<uint8_t> &&rgb) {
+      {
+        std::lock_guard<std::mutex> lock(_mutex);
+        _queue.push_back(Pending{x0, y0, width, height, std::move(rgb)});
+        _bufferedBytes += 3 * width * height;
+        _maxBufferedBytes = std::max(_maxBufferedBytes, _bufferedBytes);
+      }
+      _condition.notify_one();
+    }
+
+    /**
+     *  Write the remaining tiles and close the file
+     */
+    void finish() {
+      if (!_thread.joinable()) {
+        return;
+      }
+      {
+        std::lock_guard<std::mutex> lock(_mutex);
+        _finished = true;
+      }
+      _condition.notify_one();
+      _thread.join();
+      _os.close();
+    }
+
+    /**
+     *  Maximum size of the tiles waiting to be written, in bytes
+     */
+    size_t getMaxBufferedBytes() const {return _maxBufferedBytes;}
+
+  private:
+    struct Pending {
+      unsigned int x0;
+      unsigned int y0;
+      unsigned int width;
+      unsigned int height;
+      std::vector<uint8_t> rgb;
+    };
+
+    void _run() {
+      std::unique_lock<std::mutex> lock(_mutex);
+      while (true) {
+        _condition.wait(lock, [this]() {return _finished || !_queue.empty();});
+        if (_queue.empty()) {
+          break;
+        }
+        auto tile = std::move(_queue.front());
+        _queue.pop_front();
+        lock.unlock();
+        size_t written = _format == Format::PPM ? _addToBand(std::move(tile)) : _writeTile(tile);
+        lock.lock();
+        _bufferedBytes -= written;
+      }
+    }
+
+    /**
+     *  @return the number of bytes written (and released)
+     */
+    size_t _writeTile(const Pending &tile) {
+      // padded with the border pixels, as TextureFile::write
+      std::vector<uint8_t> padded(3 * _tileSize * _tileSize);
+      for (unsigned int y = 0; y < _tileSize; ++y) {
+        for (unsigned int x = 0; x < _tileSize; ++x) {
+          auto sx = std::min(tile.width - 1, x);
+          auto sy = std::min(tile.height - 1, y);
+          std::memcpy(&padded[3 * (y * _tileSize + x)], &tile.rgb[3 * (sy * tile.width + sx)], 3);
+        }
+      }
+      auto index = (tile.y0 / _tileSize) * _tilesX + tile.x0 / _tileSize;
+      _os.seekp(static_cast<std::streamoff>(_headerSize + index * padded.size()));
+      _os.write(reinterpret_cast<const char *>(padded.data()), padded.size());
+      return tile.rgb.size();
+    }
+
+    /**
+     *  Buffer the tile in its band, and write the complete bands in order
+     *  @return the number of bytes written (and released)
+     */
+    size_t _addToBand(Pending &&tile) {
+      auto band = tile.y0 / _tileSize;
+      _bands[band].push_back(std::move(tile));
+      size_t written = 0;
+      while (!_bands.empty() && _bands.begin()->first == _nextBand && _bands.begin()->second.size() == _tilesX) {
+        auto &tiles = _bands.begin()->second;
+        std::sort(tiles.begin(), tiles.end(), [](const Pending &a, const Pending &b) {return a.x0 < b.x0;});
+        std::vector<uint8_t> row(3 * _width);
+        for (unsigned int y = 0; y < tiles[0].height; ++y) {
+          for (auto &t: tiles) {
+            std::memcpy(&row[3 * t.x0], &t.rgb[3 * y * t.width], 3 * t.width);
+          }
+          _os.write(reinterpret_cast<const char *>(row.data()), row.size());
+        }
+        written += row.size() * tiles[0].height;
+        _bands.erase(_bands.begin());
+        ++_nextBand;
+      }
+      return written;
+    }
+
+  private:
+    unsigned int _width;
+    unsigned int _tileSize;
+    Format _format;
+    unsigned int _tilesX;
+    size_t _headerSize;
+    std::map<unsigned int, std::vector<Pending> > _bands; // PPM: tiles of the incomplete bands
+    unsigned int _nextBand; // PPM: next band to write
+    std::deque<Pending> _queue; // tiles not processed by the writer thread
+    size_t _bufferedBytes; // size of the tiles pushed and not written
+    size_t _maxBufferedBytes;
+    bool _finished;
+    std::ofstream _os;
+    std::mutex _mutex;
+    std::condition_variable _condition;
+    std::thread _thread;
+};
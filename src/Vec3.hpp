@@ -54,6 +54,11 @@ class Vec3 {
     inline Vec3 &operator/=(double val) {_v[0] /= val; _v[1] /= val; _v[2] /= val; return *this;} 
     
 
+    /**
+     *  Component-wise product
+     */
+    inline Vec3 multiply(const Vec3 &v) const {return Vec3(_v[0] * v[0], _v[1] * v[1], _v[2] * v[2]);}
+
     /**
      *  Common tests
      */
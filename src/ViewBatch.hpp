@@ -0,0 +1,229 @@
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <cmath>
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+#include "Camera.hpp"
+#include "Denoiser.hpp"
+#include "Framebuffer.hpp"
+#include "Image.hpp"
+#include "shapes/Shape.hpp"
+
+/**
+ *  Several views of the same scene (turntable, stereo pairs...) rendered
+ *  together: the scene and its BVH are built once, and the tiles of all
+ *  the views form a single queue for the threads, such that no thread
+ *  waits at the end of each view.
+ *  The buffers of a view are allocated when its first tile is taken
+ *  from the queue, and each view is denoised, post processed and
+ *  written by a writer thread as soon as its last tile is rendered,
+ *  while the threads go on with the next views. Its buffers are then
+ *  released, such that only the views in progress use memory.
+ *
+ *  Usage:
+ *    ViewBatch batch(*scene->camera);
+ *    batch.addTurntable(lookAt, 10.0, 2.0, 36, 40.0, "turntable");
+ *    batch.render(scene->world);
+ */
+class ViewBatch {
+  public:
+    /**
+     *  @param camera settings of the views (copied), and threads of the
+     *    batch
+     */
+    explicit ViewBatch(const Camera &camera): _camera(camera) {}
+
+    /**
+     *  Add a view of the batch camera from another point of view
+     */
+    void addView(const Vec3 &lookFrom, const Vec3 &lookAt, double vfov, const std::string &output) {
+      Camera camera(_camera);
+      camera.setView(lookFrom, lookAt, vfov);
+      addView(camera, output);
+    }
+
+    /**
+     *  Add a view with its own settings (resolution, lens...). It is
+     *  rendered by the threads of the batch camera.
+     *  @param output PPM file, or empty to only call the callback
+     */
+    void addView(const Camera &camera, const std::string &output) {
+      _views.push_back(std::make_shared<View>(camera, output));
+    }
+
+    /**
+     *  Add count views on a circle of radius around center, at height
+     *  above it, looking at center. The files are prefix_<i>.ppm.
+     */
+    void addTurntable(const Vec3 &center, double radius, double height, unsigned int count,
+        double vfov, const std::string &prefix) {
+      for (unsigned int i = 0; i < count; ++i) {
+        double angle = 2.0 * M_PI * i / count;
+        Vec3 lookFrom = center + Vec3(radius * std::cos(angle), height, radius * std::sin(angle));
+        addView(lookFrom, center, vfov, prefix + "_" + std::to_string(i) + ".ppm");
+      }
+    }
+
+    /**
+     *  Add the views of the left and right eyes, separated by
+     *  eyeDistance, converging on lookAt. The files are prefix_left.ppm
+     *  and prefix_right.ppm.
+     */
+    void addStereoPair(const Vec3 &lookFrom, const Vec3 &lookAt, double vfov, double eyeDistance,
+        const std::string &prefix) {
+      auto right = ((lookAt - lookFrom) ^ Vec3(0.0, 1.0, 0.0)).getNormalized() * (eyeDistance / 2.0);
+      addView(lookFrom - right, lookAt, vfov, prefix + "_left.ppm");
+      addView(lookFrom + right, lookAt, vfov, prefix + "_right.ppm");
+    }
+
+    /**
+     *  Function called with the index and the image of each finished
+     *  view, from the writer thread
+     */
+    void setCallback(std::function<void(unsigned int, const Image &)> callback) {
+      _callback = std::move(callback);
+    }
+
+    unsigned int size() const {return static_cast<unsigned int>(_views.size());}
+
+    /**
+     *  Render all the views, and return when they are all written
+     */
+    void render(const Shape &world) {
+      // first tile of each view in the shared queue
+      std::vector<unsigned int> firstTiles;
+      unsigned int tilesNumber = 0;
+      for (auto &view: _views) {
+        view->prepare();
+        firstTiles.push_back(tilesNumber);
+        tilesNumber += view->camera.getTileCount();
+      }
+      std::deque<unsigned int> finished;
+      bool done = false;
+      std::mutex mutex;
+      std::condition_variable condition;
+      std::thread writer([&]() {
+        std::unique_lock<std::mutex> lock(mutex);
+        while (true) {
+          condition.wait(lock, [&]() {return done || !finished.empty();});
+          if (finished.empty()) {
+            break;
+          }
+          auto index = finished.front();
+          finished.pop_front();
+          lock.unlock();
+          _write(index);
+          lock.lock();
+        }
+      });
+      std::atomic<unsigned int> nextTile(0);
+      _camera.getThreadPool().run([&](unsigned int worker) {
+        auto &tile = Camera::getScratchTile();
+        while (true) {
+          unsigned int t = nextTile++;
+          if (t >= tilesNumber) {
+            break;
+          }
+          auto index = static_cast<unsigned int>(std::upper_bound(firstTiles.begin(), firstTiles.end(), t) - firstTiles.begin()) - 1;
+          auto &view = *_views[index];
+          const auto &localWorld = _camera.getLocalWorld(world, worker);
+          view.renderTile(localWorld, t - firstTiles[index], tile);
+          if (--view.remainingTiles == 0) {
+            {
+              std::lock_guard<std::mutex> lock(mutex);
+              finished.push_back(index);
+            }
+            condition.notify_one();
+          }
+        }
+      });
+      {
+        std::lock_guard<std::mutex> lock(mutex);
+        done = true;
+      }
+      condition.notify_one();
+      writer.join();
+    }
+
+  private:
+    struct View {
+      View(const Camera &viewCamera, const std::string &viewOutput):
+        camera(viewCamera),
+        output(viewOutput),
+        remainingTiles(0) {}
+
+      /**
+       *  Size of the image and number of tiles, before the rendering
+       */
+      void prepare() {
+        camera.update();
+        remainingTiles = camera.getTileCount();
+        allocated.reset(new std::once_flag());
+      }
+
+      /**
+       *  Buffers of the view, by the thread of its first tile
+       */
+      void allocate() {
+        auto w = camera.getImageWidth();
+        auto h = camera.getImageHeight();
+        accumulation.reset(new AccumulationBuffer(w, h, false, camera.isDenoising()));
+        accumulation->setSamplesPerPixel(camera.getRaysPerPixel());
+        if (camera.isDenoising()) {
+          features.reset(new FeatureBuffer(w, h));
+        }
+      }
+
+      void renderTile(const Shape &world, unsigned int t, Tile &tile) {
+        // the other threads on this view wait for the buffers
+        std::call_once(*allocated, &View::allocate, this);
+        camera.resetTile(t, tile);
+        camera.renderTile(world, tile);
+        accumulation->addTile(tile);
+        if (features) {
+          camera.renderFeatures(world, tile, *features);
+        }
+      }
+
+      Camera camera;
+      std::string output;
+      std::atomic<unsigned int> remainingTiles;
+      std::unique_ptr<std::once_flag> allocated; // of each rendering
+      std::unique_ptr<AccumulationBuffer> accumulation;
+      std::unique_ptr<FeatureBuffer> features; // if denoised
+    };
+
+    /**
+     *  Finish and save a view, on a single thread since the others are
+     *  still rendering
+     */
+    void _write(unsigned int index) {
+      auto &view = *_views[index];
+      if (view.features) {
+        view.camera.getDenoiser().apply(*view.accumulation, *view.features, 1);
+      }
+      Image image(view.accumulation->width(), view.accumulation->height());
+      view.camera.getPostProcess().apply(*view.accumulation, image, 1);
+      view.accumulation.reset();
+      view.features.reset();
+      if (_callback) {
+        _callback(index, image);
+      }
+      if (!view.output.empty()) {
+        image.writePPM(view.output);
+      }
+    }
+
+  private:
+    Camera _camera;
+    std::vector<std::shared_ptr<View> > _views;
+    std::function<void(unsigned int, const Image &)> _callback;
+};
@@ -0,0 +1,125 @@
+#pragma once
+
+#include <algorithm>
+#include <cstdint>
+#include <memory>
+#include <utility>
+#include <vector>
+#include "Ray.hpp"
+#include "Hit.hpp"
+#include "Morton.hpp"
+
+/**
+ *  Data structures of the wavefront integrator: instead of tracing each
+ *  path depth first, the rays of many paths are processed one bounce at
+ *  a time, and each stage (intersection, shading) runs over the whole 
+ *  queue. This keeps the same code and data hot in the caches.
+ */
+
+/**
+ *  Branch of a path traced by the wavefront integrator
+ */
+struct PathState {
+  PathState(): sample(0), depth(0), pdf(0.0) {}
+  PathState(const Ray &ray, const Vec3 &weight, unsigned int sample, unsigned int depth, double pdf = 0.0):
+    ray(ray), weight(weight), sample(sample), depth(depth), pdf(pdf) {}
+  Ray ray;
+  Vec3 weight; // attenuation accumulated along the path
+  unsigned int sample; // index of the camera sample in the batch
+  unsigned int depth; // number of bounces so far
+  double pdf; // density of the BSDF sample that generated the ray (0 if specular)
+};
+
+/**
+ *  Ray toward a light, contributing if it is not occluded
+ */
+struct ShadowRay {
+  Ray ray;
+  double maxDist; // distance of the light along the ray
+  Vec3 contribution;
+  unsigned int sample; // index of the camera sample in the batch
+};
+
+/**
+ *  Queue of paths at the same stage
+ */
+struct RayQueue {
+  std::vector<PathState> paths;
+  std::vector<Hit> hits; // closest hit of each path
+  std::vector<unsigned int> hitIndices; // paths that hit something, binned by shape
+  std::vector<unsigned int> missIndices; // paths that escaped the scene
+
+  void clear() {
+    paths.clear();
+    hits.clear();
+    hitIndices.clear();
+    missIndices.clear();
+  }
+
+  /**
+   *  Reorder the paths such that rays with similar origins and
+   *  directions are consecutive: they then visit the same BVH nodes
+   *  and shapes, which are still in the cache. The key is the
+   *  direction octant followed by the Morton code of the origin.
+   *  @param bounds bounding box of the scene
+   */
+  void sortByCoherence(const AABB &bounds) {
+    std::vector<std::pair<uint64_t, unsigned int> > keys(paths.size());
+    for (unsigned int i = 0; i < paths.size(); ++i) {
+      auto &ray = paths[i].ray;
+      uint64_t key = (uint64_t(getOctant(ray.direction())) << 30) | getMortonCode(ray.origin(), bounds);
+      keys[i] = std::make_pair(key, i);
+    }
+    std::sort(keys.begin(), keys.end());
+    std::vector<PathState> sorted(paths.size());
+    for (unsigned int i = 0; i < keys.size(); ++i) {
+      sorted[i] = paths[keys[i].second];
+    }
+    std::swap(sorted, paths);
+  }
+
+  /**
+   *  Intersection stage: find the closest hit of all the paths, then 
+   *  sort the hits by shape such that the shading stage processes
+   *  the hits with the same material together
+   *  @param packetSize if greater than 1, consecutive rays are 
+   *    intersected as packets of this size
+   */
+  template<typename World>
+  void intersect(const World &world, double minDist, unsigned int packetSize = 1) {
+    hits.assign(paths.size(), Hit());
+    hitIndices.clear();
+    missIndices.clear();
+    if (packetSize > 1) {
+      std::vector<Ray> rays(packetSize);
+      std::unique_ptr<bool[]> found(new bool[packetSize]);
+      for (unsigned int start = 0; start < paths.size(); start += packetSize) {
+        auto size = std::min(packetSize, static_cast<unsigned int>(paths.size()) - start);
+        for (unsigned int i = 0; i < size; ++i) {
+          rays[i] = paths[start + i].ray;
+          found[i] = false;
+        }
+        world.hitPacket(rays.data(), size, minDist, &hits[start], found.get());
+        for (unsigned int i = 0; i < size; ++i) {
+          if (found[i]) {
+            hitIndices.push_back(start + i);
+          } else {
+            missIndices.push_back(start + i);
+          }
+        }
+      }
+    } else {
+      for (unsigned int i = 0; i < paths.size(); ++i) {
+        if (world.hit(paths[i].ray, minDist, hits[i])) {
+          hitIndices.push_back(i);
+        } else {
+          missIndices.push_back(i);
+        }
+      }
+    }
+    std::sort(hitIndices.begin(), hitIndices.end(), 
+        [this](unsigned int i1, unsigned int i2) {
+          return hits[i1].shape < hits[i2].shape;
+        });
+  }
+};
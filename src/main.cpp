@@ -5,22 +5,51 @@
 #include "Camera.hpp"
 #include "scenes/SceneFramedMirror.hpp"
 #include "scenes/SceneParallelepipeds.hpp"
+#include "scenes/SceneMotionBlur.hpp"
+#include "scenes/SceneMaterials.hpp"
+#include "scenes/SceneTextures.hpp"
+#include "scenes/SceneEnvironment.hpp"
+#include "scenes/SceneCity.hpp"
+#include "Regression.hpp"
 
 
 
 
 
-int main(int, char **)
+int main(int argc, char **argv)
 {
+  // raytracer --regression [directory] [--update] [--timing baseline]:
+  // check the scenes against the reference images, and the timings
+  // against a baseline of this machine
+  if (argc > 1 && std::string(argv[1]) == "--regression") {
+    int arg = 2;
+    Regression regression(arg < argc && argv[arg][0] != '-' ? argv[arg++] : "regression");
+    for (; arg < argc; ++arg) {
+      std::string option = argv[arg];
+      if (option == "--update") {
+        regression.setUpdate(true);
+      } else if (option == "--timing" && arg + 1 < argc) {
+        regression.setTiming(argv[++arg]);
+      } else {
+        std::cerr << "unknown option " << option << std::endl;
+        return 2;
+      }
+    }
+    return regression.run(std::cout) ? 0 : 1;
+  }
   auto start = std::chrono::high_resolution_clock::now();
   unsigned int imageWidth = 1200;
-  double raysPerPixel = 500;
-  unsigned int cores = 10;
+  double raysPerPixel = 64;
+  unsigned int cores = 0; // all the cores
   std::cout << "Creating scene..." << std::endl;
 
   auto scene = createSceneParallelepiped(imageWidth, raysPerPixel, cores);
 
+  // 64 denoised rays per pixel look like 500 noisy ones
+  scene->camera->setDenoising(true);
   scene->beforeRender();
+  // copy of the BVH in the memory of each NUMA node (multi-socket machines)
+  scene->replicateWorld();
   std::cout << "Start ray tracing..." << std::endl;
   scene->camera->render(scene->world);
   auto end = std::chrono::high_resolution_clock::now();
@@ -0,0 +1,120 @@
+#pragma once
+
+#include "../Scene.hpp"
+#include "../shapes/Shapes.hpp"
+#include "../shapes/Quad.hpp"
+#include "../shapes/Sphere.hpp"
+#include "../shapes/Parallelepiped.hpp"
+#include "../shapes/ChunkedGeometry.hpp"
+#include "../shapes/LevelOfDetail.hpp"
+#include "../shapes/BVH.hpp"
+#include "../Camera.hpp"
+#include "../Random.hpp"
+
+
+/**
+ *  City of blocks x blocks blocks of buildings seen from above, with
+ *  domes on some roofs
+ *  @param geometryPath if not empty, the buildings are written to this
+ *    geometry file and rendered out of core (see ChunkedGeometry),
+ *    otherwise they are ordinary shapes. The file is reused by the
+ *    next scenes with the same number of blocks.
+ *  @param geometryBudget memory budget of the loaded geometry, in bytes
+ *  @param levelsOfDetail if true (and not out of core), each block is
+ *    a LevelOfDetail whose coarse version has no domes, for the rays
+ *    wider than the domes
+ */
+std::shared_ptr<Scene> createSceneCity(unsigned int imageWidth,
+  unsigned int raysPerPixel,
+  unsigned int cores,
+  unsigned int blocks = 16,
+  const std::string &geometryPath = "",
+  size_t geometryBudget = size_t(256) << 20,
+  bool levelsOfDetail = false)
+{
+  auto scene = std::make_shared<Scene>();
+  std::vector<const Material *> materials{
+    scene->create<Material>(Material::lambertian(Vec3(0.7, 0.7, 0.7))),
+    scene->create<Material>(Material::lambertian(Vec3(0.8, 0.6, 0.4))),
+    scene->create<Material>(Material::lambertian(Vec3(0.5, 0.5, 0.6))),
+    scene->create<Material>(Material::metal(Vec3(0.8, 0.8, 0.9), 0.2))
+  };
+  const double blockSize = 10.0;
+  const double street = 3.0;
+  const unsigned int buildingsPerSide = 3;
+  auto ground = scene->create<Material>(Material::lambertian(Vec3(0.3, 0.3, 0.3)));
+  double citySize = blocks * (blockSize + street);
+  scene->addBigShape(scene->create<Quad>(Vec3(-citySize, 0.0, -citySize),
+      Vec3(3.0 * citySize, 0.0, 0.0),
+      Vec3(0.0, 0.0, 3.0 * citySize),
+      *ground));
+
+  // the buildings are generated in the same order in both modes
+  GeometryFile file;
+  bool outOfCore = !geometryPath.empty();
+  // the buildings only depend on the number of blocks
+  uint32_t key = blocks;
+  uint32_t fileKey;
+  bool generate = !outOfCore || !GeometryFile::readKey(geometryPath, fileKey) || fileKey != key;
+  if (generate) {
+    Random rng(7);
+    double lot = blockSize / buildingsPerSide;
+    for (unsigned int bx = 0; bx < blocks; ++bx) {
+      for (unsigned int bz = 0; bz < blocks; ++bz) {
+        // shapes of the block, with and without the domes
+        std::vector<Shape *> detailed;
+        std::vector<Shape *> coarse;
+        double maxDome = 0.0;
+        for (unsigned int i = 0; i < buildingsPerSide * buildingsPerSide; ++i) {
+          Vec3 corner(bx * (blockSize + street) + (i % buildingsPerSide) * lot - citySize / 2.0,
+              0.0,
+              bz * (blockSize + street) + (i / buildingsPerSide) * lot - citySize / 2.0);
+          double width = lot * rng.getRand(0.6, 0.9);
+          double height = rng.getRand(2.0, 12.0);
+          auto material = static_cast<uint32_t>(rng.getRand(0.0, 3.0));
+          auto dome = rng.getRand() < 0.2;
+          Vec3 center = corner + Vec3(width / 2.0, height, width / 2.0);
+          if (outOfCore) {
+            file.addParallelepiped(corner, Vec3(width, 0.0, 0.0), Vec3(0.0, height, 0.0), Vec3(0.0, 0.0, width), material);
+            if (dome) {
+              file.addSphere(center, width / 2.0, 3);
+            }
+          } else {
+            auto building = scene->create<Parallelepiped>(corner,
+                Vec3(width, 0.0, 0.0), Vec3(0.0, height, 0.0), Vec3(0.0, 0.0, width), *materials[material]);
+            detailed.push_back(building);
+            coarse.push_back(building);
+            if (dome) {
+              detailed.push_back(scene->create<Sphere>(center, width / 2.0, *materials[3]));
+              maxDome = std::max(maxDome, width / 2.0);
+            }
+          }
+        }
+        if (levelsOfDetail && maxDome > 0.0) {
+          auto block = scene->create<LevelOfDetail>();
+          block->addLevel(scene->create<BVH>(detailed), 0.0);
+          block->addLevel(scene->create<BVH>(coarse), maxDome);
+          scene->addSmallShape(block);
+        } else {
+          for (auto shape: detailed) {
+            scene->addSmallShape(shape);
+          }
+        }
+      }
+    }
+  }
+  if (outOfCore) {
+    if (generate) {
+      file.write(geometryPath, key);
+    }
+    scene->addBigShape(scene->create<ChunkedGeometry>(geometryPath, materials, geometryBudget));
+  }
+
+  double fov = 50;
+  double aspectRatio = 1.5;
+  Vec3 lookFrom(-citySize * 0.6, citySize * 0.35, -citySize * 0.6);
+  Vec3 lookAt(0.0, 0.0, 0.0);
+  scene->camera = std::make_shared<Camera>(aspectRatio, imageWidth, fov, raysPerPixel, lookFrom, lookAt, cores);
+  scene->camera->setBackgrounds(Vec3(1.0, 1.0, 1.0), Vec3(0.5, 0.6, 0.9));
+  return scene;
+}
@@ -0,0 +1,52 @@
+#pragma once
+
+#include "../Scene.hpp"
+#include "../shapes/Shapes.hpp"
+#include "../shapes/Sphere.hpp"
+#include "../shapes/Quad.hpp"
+#include "../Camera.hpp"
+#include "../EnvironmentMap.hpp"
+
+
+/**
+ *  Outdoor scene lit only by an environment map (PFM or PPM):
+ *  diffuse, metallic and glass balls on a diffuse ground
+ *  @param importanceSampling sample the environment at each hit
+ */
+std::shared_ptr<Scene> createSceneEnvironment(unsigned int imageWidth,
+  unsigned int raysPerPixel,
+  unsigned int cores,
+  const std::string &environmentPath,
+  bool importanceSampling = true) 
+{
+  auto scene = std::make_shared<Scene>();
+  auto environment = scene->create<EnvironmentMap>(EnvironmentMap::load(environmentPath));
+
+  auto groundMaterial = scene->create<Material>(Material::lambertian(Vec3(0.5, 0.5, 0.5)));
+  double groundSize = 100.0;
+  auto ground = scene->create<Quad>(Vec3(-groundSize / 2.0, 0.0, -groundSize/ 2.0), 
+      Vec3(groundSize, 0.0, 0.0),
+      Vec3(0.0, 0.0, groundSize), 
+      *groundMaterial);
+  scene->addBigShape(ground);
+
+  double radius = 1.0;
+  Material *materials[] = {
+    scene->create<Material>(Material::lambertian(Vec3(0.8, 0.3, 0.2))),
+    scene->create<Material>(Material::metal(Vec3(0.9, 0.9, 0.9), 0.3)),
+    scene->create<Material>(Material::dielectric(1.5)),
+    scene->create<Material>(Material::lambertian(Vec3(0.2, 0.5, 0.8)))
+  };
+  for (int i = 0; i < 4; ++i) {
+    Vec3 center((double(i) - 1.5) * 2.5, radius, 0.0);
+    scene->addSmallShape(scene->create<Sphere>(center, radius, *materials[i]));
+  }
+
+  double fov = 40;
+  double aspectRatio = 1.5;
+  Vec3 lookFrom(0, 3, -10);
+  Vec3 lookAt(0.0, 1.0, 0.0);
+  scene->camera = std::make_shared<Camera>(aspectRatio, imageWidth, fov, raysPerPixel, lookFrom, lookAt, cores);
+  scene->camera->setEnvironment(environment, importanceSampling);
+  return scene;
+}
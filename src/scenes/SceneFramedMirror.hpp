@@ -1,3 +1,5 @@
+#pragma once
+
 
 #include "../Scene.hpp"
 #include "../shapes/Shapes.hpp"
@@ -7,49 +9,42 @@
 #include "../shapes/BVH.hpp"
 #include "../shapes/FramedQuad.hpp"
 #include "../SphereCollisionManager.hpp"
+#include "../Scatter.hpp"
 
 
 
 
 std::shared_ptr<Scene> createSceneFramedMirror(unsigned int imageWidth,
   unsigned int raysPerPixel,
-  unsigned int cores) 
+  unsigned int cores,
+  unsigned int seed = 42) 
 {
   auto scene = std::make_shared<Scene>();
   
-  auto diffuseGreen = std::make_shared<Material>(0.0, 0.0, 1.0, 0.0, Vec3(0., 0.5, 0.));
-  auto greenMetal = std::make_shared<Material>(0.0, 0.5, 0.0, 0.0, Vec3(0., 0.5, 0.));
-  auto blueStuff = std::make_shared<Material>(0.0, 0.0, 0.3, 0.5, Vec3(0., 0., 0.7));
-  auto redStuff = std::make_shared<Material>(0.0, 0.0, 0.5, 0.5, Vec3(0.7, 0., 0.));
-  auto mirror = std::make_shared<Material>(0.0, 1.0, 0.0, 0.0, Vec3(1, 1, 1));
-  auto mirrorAttenuated = std::make_shared<Material>(0.3, 0.8, 0.0, 0.0, Vec3(1, 1, 1));
-
-  scene->materials.push_back(diffuseGreen);
-  scene->materials.push_back(greenMetal);
-  scene->materials.push_back(blueStuff);
-  scene->materials.push_back(redStuff);
-  scene->materials.push_back(mirror);
-  scene->materials.push_back(mirrorAttenuated);
+  auto greenMetal = scene->create<Material>(0.0, 0.5, 0.0, 0.0, Vec3(0., 0.5, 0.));
+  auto redStuff = scene->create<Material>(0.0, 0.0, 0.5, 0.5, Vec3(0.7, 0., 0.));
+  auto mirrorAttenuated = scene->create<Material>(0.3, 0.8, 0.0, 0.0, Vec3(1, 1, 1));
 
   double groundRadius = 300;
   Vec3 groundCenter(0.0, -groundRadius, 1.0);
   auto bigBallRadius = 2.5;
   auto bigBallDepth = 5.0;
   // ground
-  auto ground = std::make_shared<Sphere>(groundCenter, groundRadius, *greenMetal);
+  auto ground = scene->create<Sphere>(groundCenter, groundRadius, *greenMetal);
   scene->addBigShape(ground);
   scene->collisionManager.addSphere(ground);
   // reflective big ball
   /*
-  auto bigBall = std::make_shared<Sphere>(Vec3(0, bigBallRadius, bigBallDepth), bigBallRadius, mirror);
-  bigWorld.addShape(bigBall.get());
-  shapeContainer.addSphere(bigBall);
+  Material mirror(0.0, 1.0, 0.0, 0.0, Vec3(1, 1, 1));
+  auto bigBall = scene->create<Sphere>(Vec3(0, bigBallRadius, bigBallDepth), bigBallRadius, mirror);
+  scene->addBigShape(bigBall);
+  scene->collisionManager.addSphere(bigBall);
   */
   // reflective wall
   auto quadW = 15.0;
   auto quadH = 5.0;
   auto quadDepth = 5.1 + bigBallDepth;
-  auto quad = std::make_shared<FramedQuad>(Vec3(-quadW * 2.0, quadH / 2.0, quadDepth),
+  auto quad = scene->create<FramedQuad>(Vec3(-quadW * 2.0, quadH / 2.0, quadDepth),
       Vec3(quadW, 0.0, 0.0),
       Vec3(0.0, quadH, 0.0),
       0.2,
@@ -58,30 +53,24 @@ std::shared_ptr<Scene> createSceneFramedMirror(unsigned int imageWidth,
   scene->addBigShape(quad);
 
   
-  unsigned int addedSpheres = 0;
-  while (addedSpheres < 300) {
-    auto x = getRand(-20.0, 20.0);
-    double radius = 0.5;
-    //auto y = getRand(radius, radius + 5.0);
+  // scatter small spheres on the ground
+  double radius = 0.5;
+  SphereScatter scatter(radius, seed, cores);
+  auto generator = [&](Random &rng, Vec3 &position, double &r) {
+    auto x = rng.getRand(-20.0, 20.0);
     auto y = 0.0;
-    auto z = getRand(-20, quadDepth - 5.0);
-    Vec3 position(x,y,z);
+    auto z = rng.getRand(-20, quadDepth - 5.0);
+    position = Vec3(x, y, z);
     auto cp = groundCenter - position;
     position += cp.getNormalized() * (cp.norm() - groundRadius - radius);
-    std::shared_ptr<Material> material;
-    Vec3 color = Vec3::getRandomVector(0.0, 1.0);
-    auto r = getRand();
-    if (r < 1.0) {
-      material = std::make_shared<Material>(0.0, 0.0, 0.5, 0.5, color);
-    } else {
-      material = std::make_shared<Material>(0.0, 1.0, 0.0, 0.0, Vec3(1.0, 1.0, 1.0));
-    }
-    auto shape = std::make_shared<Sphere>(position, radius, *material);
-    if (scene->collisionManager.canAddSphere(shape)) {
-      scene->addSmallShape(shape);
-      scene->collisionManager.addSphere(shape);
-      addedSpheres++;
-    } 
+    r = radius;
+  };
+  for (auto &candidate: scatter.scatter(300, generator, &scene->collisionManager)) {
+    Vec3 color = candidate.rng.getRandomVector(0.0, 1.0);
+    Material material(0.0, 0.0, 0.5, 0.5, color);
+    auto shape = scene->create<Sphere>(candidate.center, candidate.radius, material);
+    scene->addSmallShape(shape);
+    scene->collisionManager.addSphere(shape);
   }
   double fov = 30;
   double aspectRatio = 1.5;
@@ -0,0 +1,65 @@
+#pragma once
+
+#include "../Scene.hpp"
+#include "../shapes/Shapes.hpp"
+#include "../shapes/Sphere.hpp"
+#include "../shapes/Quad.hpp"
+#include "../Camera.hpp"
+
+
+/**
+ *  The physically based materials side by side: glass balls of
+ *  increasing index of refraction in the front row, metals of
+ *  increasing roughness in the back row, on a diffuse checkered ground
+ *  lit by the sky and by an emissive panel.
+ *  @param aperture diameter of the lens of the camera, focused on the
+ *    glass balls (0 for a sharp image)
+ *  @param dispersion Cauchy coefficient of the glass (see
+ *    Material::dielectric), rendered spectrally if not 0
+ */
+std::shared_ptr<Scene> createSceneMaterials(unsigned int imageWidth,
+  unsigned int raysPerPixel,
+  unsigned int cores,
+  double aperture = 0.0,
+  double dispersion = 0.0) 
+{
+  auto scene = std::make_shared<Scene>();
+  // checkered ground, made of tiles
+  auto white = scene->create<Material>(Material::lambertian(Vec3(0.8, 0.8, 0.8)));
+  auto grey = scene->create<Material>(Material::lambertian(Vec3(0.3, 0.3, 0.35)));
+  double tileSize = 2.0;
+  for (int i = -8; i < 8; ++i) {
+    for (int j = -4; j < 8; ++j) {
+      auto material = ((i + j) % 2) ? white : grey;
+      auto tile = scene->create<Quad>(Vec3(i * tileSize, 0.0, j * tileSize),
+          Vec3(tileSize, 0.0, 0.0),
+          Vec3(0.0, 0.0, tileSize),
+          *material);
+      scene->addSmallShape(tile);
+    }
+  }
+
+  double radius = 0.8;
+  for (int i = 0; i < 4; ++i) {
+    double x = (double(i) - 1.5) * 2.0;
+    auto glass = scene->create<Material>(Material::dielectric(1.2 + 0.2 * i, Vec3(0.95, 0.95, 1.0), dispersion));
+    scene->addSmallShape(scene->create<Sphere>(Vec3(x, radius, 0.0), radius, *glass));
+    auto metal = scene->create<Material>(Material::metal(Vec3(0.95, 0.7, 0.4), 0.1 + 0.25 * i));
+    scene->addSmallShape(scene->create<Sphere>(Vec3(x, radius, 3.0), radius, *metal));
+  }
+  auto light = scene->create<Material>(Material::emissive(Vec3(1.0, 0.9, 0.8), 4.0));
+  scene->addSmallShape(scene->create<Quad>(Vec3(-3.0, 4.0, 5.0),
+      Vec3(6.0, 0.0, 0.0),
+      Vec3(0.0, 2.0, 0.5),
+      *light));
+
+  double fov = 40;
+  double aspectRatio = 1.5;
+  Vec3 lookFrom(0, 3, -8);
+  Vec3 lookAt(0.0, 0.5, 1.5);
+  scene->camera = std::make_shared<Camera>(aspectRatio, imageWidth, fov, raysPerPixel, lookFrom, lookAt, cores);
+  scene->camera->setBackgrounds(Vec3(0.6, 0.6, 0.6), Vec3(0.3, 0.4, 0.7));
+  scene->camera->setLens(aperture, (Vec3(0.0, radius, 0.0) - lookFrom).norm());
+  scene->camera->setSpectral(dispersion != 0.0);
+  return scene;
+}
@@ -0,0 +1,57 @@
+#pragma once
+
+#include "../Scene.hpp"
+#include "../shapes/Shapes.hpp"
+#include "../shapes/Sphere.hpp"
+#include "../shapes/Quad.hpp"
+#include "../shapes/Moving.hpp"
+#include "../Camera.hpp"
+#include "../Random.hpp"
+
+
+/**
+ *  Rows of balls moving at different speeds above a diffuse ground
+ *  Rendered with a shutter open during the whole time interval
+ *  @param seed seed of the colors and directions of the balls
+ */
+std::shared_ptr<Scene> createSceneMotionBlur(unsigned int imageWidth,
+  unsigned int raysPerPixel,
+  unsigned int cores,
+  unsigned int seed = 42) 
+{
+  Random rng(seed);
+  auto scene = std::make_shared<Scene>();
+  auto groundMaterial = scene->create<Material>(0.0, 0.0, 0.7, 0.3, Vec3(0.3, 0.3, 0.3));
+  double groundSize = 40.0;
+  auto ground = scene->create<Quad>(Vec3(-groundSize / 2.0, 0.0, -groundSize/ 2.0), 
+      Vec3(groundSize, 0.0, 0.0),
+      Vec3(0.0, 0.0, groundSize), 
+      *groundMaterial);
+  scene->addBigShape(ground);
+
+  double radius = 0.5;
+  for (int row = 0; row < 3; ++row) {
+    for (int i = 0; i < 7; ++i) {
+      Vec3 color = rng.getRandomVector(0.2, 1.0);
+      auto material = scene->create<Material>(0.0, 0.0, 0.5, 0.5, color);
+      Vec3 center(double(i - 3) * 1.5, radius, double(row) * 2.0);
+      auto sphere = scene->create<Sphere>(center, radius, *material);
+      // the first row is static, the others move faster and faster
+      auto speed = 0.4 * double(row);
+      if (speed > 0.0) {
+        auto displacement = Vec3(speed, rng.getRand(0.0, speed), 0.0);
+        scene->addSmallShape(scene->create<Moving>(sphere, displacement));
+      } else {
+        scene->addSmallShape(sphere);
+      }
+    }
+  }
+
+  double fov = 30;
+  double aspectRatio = 1.5;
+  Vec3 lookFrom(0, 4, -15);
+  Vec3 lookAt(0.0, 1.0, 2.0);
+  scene->camera = std::make_shared<Camera>(aspectRatio, imageWidth, fov, raysPerPixel, lookFrom, lookAt, cores);
+  scene->camera->setShutter(0.0, 1.0);
+  return scene;
+}
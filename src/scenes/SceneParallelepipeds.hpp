@@ -1,3 +1,5 @@
+#pragma once
+
 
 #include "../Scene.hpp"
 #include "../shapes/Shapes.hpp"
@@ -9,11 +11,17 @@
 #include "../SphereCollisionManager.hpp"
 #include "../shapes/Parallelepiped.hpp"
 #include "../shapes/Axis.hpp"
+#include "../shapes/Volume.hpp"
+#include "../Medium.hpp"
 
 
 class TrafficLights: public Shapes {
 public:
-    TrafficLights(Vec3 center, 
+    /**
+     *  The sub-shapes are allocated in arena
+     */
+    TrafficLights(Arena &arena,
+        Vec3 center, 
         double scaler,
         double lightIntensity,
         unsigned int state) :
@@ -43,47 +51,40 @@ public:
         center[1] += poleLength;
         auto boxWidth = scaler;
         auto boxHeight = scaler * 3.0;
-        auto box = std::make_shared<Parallelepiped>(center - Vec3(boxWidth / 2.0, 0.0, boxWidth / 2.0), 
+        auto box = arena.make<Parallelepiped>(center - Vec3(boxWidth / 2.0, 0.0, boxWidth / 2.0), 
             Vec3(boxWidth, 0.0, 0.0),
             Vec3(0.0, boxHeight, 0.0),
             Vec3(0.0, 0.0, boxWidth),
             darkDiffuse);
-        _buffer.push_back(box);
-        addShape(box.get());
+        addShape(box);
         
         auto poleWidth = scaler / 4.0;
-        auto pole = std::make_shared<Parallelepiped>(center - Vec3(poleWidth / 2.0, 0.0, poleWidth /2.0), 
+        auto pole = arena.make<Parallelepiped>(center - Vec3(poleWidth / 2.0, 0.0, poleWidth /2.0), 
             Vec3(poleWidth, 0.0, 0.0),
             Vec3(0.0, -poleLength, 0.0),
             Vec3(0.0, 0.0, poleWidth),
             darkDiffuse);
-        _buffer.push_back(pole);
-        addShape(pole.get());
+        addShape(pole);
         double baseLength = scaler * 4.0;
         double baseHight = scaler * 0.3;
-        auto base = std::make_shared<Parallelepiped>(center + Vec3(-baseLength / 2.0, -poleLength, -baseLength / 2.0), 
+        auto base = arena.make<Parallelepiped>(center + Vec3(-baseLength / 2.0, -poleLength, -baseLength / 2.0), 
             Vec3(baseLength, 0.0, 0.0),
             Vec3(0.0, baseHight, 0.0),
             Vec3(0.0, 0.0, baseLength),
             darkDiffuse);
-        _buffer.push_back(base);
-        addShape(base.get());
+        addShape(base);
         auto  ballRadius = scaler * 0.3   ;
         auto ballX = 0.0; // scaler * 0.5;
         auto ballY = scaler * 1.5;
         auto ballZ = scaler * 0.4;
-        auto ball1 = std::make_shared<Sphere>(center + Vec3(ballX, ballY + scaler       , ballZ), ballRadius, redLight);
-        auto ball2 = std::make_shared<Sphere>(center + Vec3(ballX, ballY + 0.0          , ballZ), ballRadius, orangeLight);
-        auto ball3 = std::make_shared<Sphere>(center + Vec3(ballX, ballY -scaler        , ballZ), ballRadius, greenLight);
-        _buffer.push_back(ball1);
-        addShape(ball1.get());
-        _buffer.push_back(ball2);
-        addShape(ball2.get());
-        _buffer.push_back(ball3);
-        addShape(ball3.get());
+        auto ball1 = arena.make<Sphere>(center + Vec3(ballX, ballY + scaler       , ballZ), ballRadius, redLight);
+        auto ball2 = arena.make<Sphere>(center + Vec3(ballX, ballY + 0.0          , ballZ), ballRadius, orangeLight);
+        auto ball3 = arena.make<Sphere>(center + Vec3(ballX, ballY -scaler        , ballZ), ballRadius, greenLight);
+        addShape(ball1);
+        addShape(ball2);
+        addShape(ball3);
     }
 private:
-    std::vector<std::shared_ptr<Shape> > _buffer;
     Material darkDiffuse;
     Material redLight;
     Material orangeLight;
@@ -91,38 +92,69 @@ private:
 };
 
 
+/**
+ *  Three traffic lights on a glossy ground, under a pink moon
+ *  @param fog add a thin homogeneous fog over the ground, and smoke
+ *    rising from the middle traffic light
+ */
 std::shared_ptr<Scene> createSceneParallelepiped(unsigned int imageWidth,
   unsigned int raysPerPixel,
-  unsigned int cores) 
+  unsigned int cores,
+  bool fog = false) 
 {
     auto scene = std::make_shared<Scene>();
 
-    auto attenuatedMirror = std::make_shared<Material>(0.4, 0.6, 0.1, 0.0, Vec3(1, 1, 1));
+    auto attenuatedMirror = scene->create<Material>(0.4, 0.6, 0.1, 0.0, Vec3(1, 1, 1));
     Vec3 pink = Vec3(255,192,203) / 255.0;
-    auto light = std::make_shared<Material>(0.0, 0.0, 0.0, 1.0, Vec3(10, 10, 10));
-    auto pinkLight = std::make_shared<Material>(0.0, 0.0, 0.0, 1.0, pink * 10.0);
+    auto pinkLight = scene->create<Material>(0.0, 0.0, 0.0, 1.0, pink * 10.0);
     attenuatedMirror->setFuzz(0.015);
- 
-    scene->materials.push_back(attenuatedMirror);
-    scene->materials.push_back(light);
 
     double groundSize = 20.0;
-    auto ground = std::make_shared<Quad>(Vec3(-groundSize / 2.0, 0.0, -groundSize/ 2.0), 
+    auto ground = scene->create<Quad>(Vec3(-groundSize / 2.0, 0.0, -groundSize/ 2.0), 
             Vec3(groundSize, 0.0, 0.0),
             Vec3(0.0, 0.0, groundSize), 
             *attenuatedMirror);
     scene->addBigShape(ground);
 
-    //scene->addBigShape(std::make_shared<Axis>(Vec3(), 0.5, 5.0));
+    //scene->addBigShape(scene->create<Axis>(Vec3(), 0.5, 5.0));
     for (int i = 0; i < 3; ++i) {
         double intensity = 10.0;
-        auto trafficLights = std::make_shared<TrafficLights>(Vec3(double(i - 1) * 4.0, 0.0, 0.0), 0.5, intensity, i);
+        auto trafficLights = scene->create<TrafficLights>(scene->arena, Vec3(double(i - 1) * 4.0, 0.0, 0.0), 0.5, intensity, i);
         scene->addBigShape(trafficLights);
     }
-    //auto moon = std::make_shared<Quad>(Vec3(20, 20, 20), Vec3(20.0, 0.0, 0.0), Vec(0.0, 0.0, 0.0), light);
-    auto moon = std::make_shared<Sphere>(Vec3(20, 10, 10), 10.0, *pinkLight);
+    //auto moon = scene->create<Quad>(Vec3(20, 20, 20), Vec3(20.0, 0.0, 0.0), Vec(0.0, 0.0, 0.0), *pinkLight);
+    auto moon = scene->create<Sphere>(Vec3(20, 10, 10), 10.0, *pinkLight);
     scene->addBigShape(moon);
 
+    if (fog) {
+      auto fogMaterial = scene->create<Material>(Material::isotropic(Vec3(0.9, 0.9, 0.9)));
+      auto fogBox = scene->create<Parallelepiped>(Vec3(-groundSize / 2.0, 0.0, -groundSize / 2.0),
+          Vec3(groundSize, 0.0, 0.0),
+          Vec3(0.0, 6.0, 0.0),
+          Vec3(0.0, 0.0, groundSize),
+          *fogMaterial);
+      auto fogMedium = scene->create<HomogeneousMedium>(0.01);
+      scene->addBigShape(scene->create<Volume>(fogBox, fogMedium, *fogMaterial));
+      // smoke plume: a cone widening with the height, with ripples
+      Vec3 smokeCorner(-1.5, 5.0, -1.5);
+      Vec3 smokeSize(3.0, 4.0, 3.0);
+      auto smoke = scene->create<GridMedium>(smokeCorner, smokeSize, 48, 64, 48);
+      smoke->fill([](const Vec3 &p) {
+        auto h = p[1] - 5.0;
+        auto radius = 0.2 + 0.25 * h + 0.1 * sin(4.0 * h);
+        auto dx = p[0] - 0.3 * sin(1.5 * h);
+        auto r = sqrt(dx * dx + p[2] * p[2]);
+        return r < radius ? 10.0 * (1.0 - r / radius) * (1.0 - h / 4.0) : 0.0;
+      });
+      auto smokeMaterial = scene->create<Material>(Material::isotropic(Vec3(0.8, 0.8, 0.8)));
+      auto smokeBox = scene->create<Parallelepiped>(smokeCorner,
+          Vec3(smokeSize[0], 0.0, 0.0),
+          Vec3(0.0, smokeSize[1], 0.0),
+          Vec3(0.0, 0.0, smokeSize[2]),
+          *smokeMaterial);
+      scene->addBigShape(scene->create<Volume>(smokeBox, smoke, *smokeMaterial));
+    }
+
 
   double fov = 20;
   double aspectRatio = 1.0;
@@ -0,0 +1,68 @@
+#pragma once
+
+#include "../Scene.hpp"
+#include "../shapes/Shapes.hpp"
+#include "../shapes/Sphere.hpp"
+#include "../shapes/Quad.hpp"
+#include "../Camera.hpp"
+#include "../Texture.hpp"
+
+
+/**
+ *  Get a texture from a PPM image, converted to a .rtt file next to it,
+ *  again when the image is edited
+ */
+inline const ImageTexture *loadTexture(Scene &scene, const std::string &ppm) {
+  auto path = ppm + ".rtt";
+  uint32_t key;
+  if (!TextureFile::readKey(path, key) || key != TextureFile::getSourceKey(ppm)) {
+    TextureFile::convertPPM(ppm, path);
+  }
+  return scene.textures.load(path);
+}
+
+/**
+ *  Textured balls on a textured ground. The first image is used for
+ *  the ground and the others for the balls (in turn).
+ *  @param images PPM files
+ *  @param textureBudget memory budget of the texture cache, in bytes
+ */
+std::shared_ptr<Scene> createSceneTextures(unsigned int imageWidth,
+  unsigned int raysPerPixel,
+  unsigned int cores,
+  const std::vector<std::string> &images,
+  size_t textureBudget = size_t(256) << 20) 
+{
+  assert(!images.empty());
+  auto scene = std::make_shared<Scene>();
+  scene->textures.setBudget(textureBudget);
+  std::vector<const ImageTexture *> textures;
+  for (auto &image: images) {
+    textures.push_back(loadTexture(*scene, image));
+  }
+
+  auto groundMaterial = scene->create<Material>(Material::lambertian(Vec3(0.8, 0.8, 0.8)));
+  groundMaterial->setTexture(textures[0]);
+  double groundSize = 40.0;
+  auto ground = scene->create<Quad>(Vec3(-groundSize / 2.0, 0.0, -groundSize/ 2.0), 
+      Vec3(groundSize, 0.0, 0.0),
+      Vec3(0.0, 0.0, groundSize), 
+      *groundMaterial);
+  scene->addBigShape(ground);
+
+  double radius = 1.0;
+  for (int i = 0; i < 5; ++i) {
+    auto material = scene->create<Material>(0.0, 0.0, 0.7, 0.3, Vec3(1.0, 1.0, 1.0));
+    auto ballTextures = textures.size() - 1;
+    material->setTexture(ballTextures ? textures[1 + i % ballTextures] : textures[0]);
+    Vec3 center(double(i - 2) * 2.5, radius, 0.0);
+    scene->addSmallShape(scene->create<Sphere>(center, radius, *material));
+  }
+
+  double fov = 40;
+  double aspectRatio = 1.5;
+  Vec3 lookFrom(0, 3, -10);
+  Vec3 lookAt(0.0, 1.0, 0.0);
+  scene->camera = std::make_shared<Camera>(aspectRatio, imageWidth, fov, raysPerPixel, lookFrom, lookAt, cores);
+  return scene;
+}
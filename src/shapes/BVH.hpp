@@ -1,56 +1,53 @@
 #pragma once
 
-#include <unordered_set>
 #include <vector>
 #include <assert.h>
 #include <algorithm>
 #include "../AABB.hpp"
-
-using ShapeSet = std::unordered_set<Shape *>;
+#include "../Arena.hpp"
 
 class BVHNode {
 public:
   /**
    *  Constructor
-   *  @param shapes: the shapes to store
+   *  The shapes in [begin, end) are reordered in place, such that
+   *  each node only stores a range of the shape array
+   *  @param begin: the first shape to store
+   *  @param end: one past the last shape to store
    *  @param axis the current axis (0, 1, 2 for x, y, z) to split
+   *  @param arena the arena allocating the children nodes
    */
-  BVHNode(const std::vector<Shape *> &shapes, unsigned int axis): _isLeaf(false) {
+  BVHNode(Shape **begin, Shape **end, unsigned int axis, Arena &arena): 
+    _isLeaf(false),
+    _left(nullptr),
+    _right(nullptr),
+    _begin(begin),
+    _end(end) 
+  {
     assert(axis < 3);
-    for (auto shape: shapes) {
-      _aabb.unionWith(shape->getAABB());
+    for (auto it = begin; it != end; ++it) {
+      _aabb.unionWith((*it)->getAABB());
     }
-    if (shapes.size() <= 4) {
-      _isLeaf = true;
+    if (end - begin <= 4) {
       // leaf case
-      for (auto shape: shapes) {
-        _shapes.insert(shape);
-      }
+      _isLeaf = true;
       return;
     }
     // internal node
-    auto sortedShapes = shapes;
-    // sort the shapes according to their center on the current axis
-    std::sort(sortedShapes.begin(), sortedShapes.end(), 
+    // split the shapes in to sets of same size, according to their
+    // center on the current axis (for moving shapes, the center of 
+    // the box swept during the shutter). No need to fully sort them.
+    auto middle = begin + (end - begin + 1) / 2;
+    std::nth_element(begin, middle, end,
         [axis](Shape *s1, Shape *s2) {
-            return s1->getAABB().getInterval(axis).getCenter() > 
-                   s2->getAABB().getInterval(axis).getCenter();
+            return s1->getAABB().getSweptInterval(axis).getCenter() > 
+                   s2->getAABB().getSweptInterval(axis).getCenter();
           }
         ); 
-    // split the shapes in to sets of same size
-    std::vector<Shape *> leftShapes;
-    std::vector<Shape *> rightShapes;
-    auto middle = (sortedShapes.size() + 1) / 2;
-    for (unsigned int i = 0; i < middle; ++i) {
-      leftShapes.push_back(sortedShapes[i]);
-    }
-    for (unsigned int i = middle; i < sortedShapes.size(); ++i) {
-      rightShapes.push_back(sortedShapes[i]);
-    }
     // recursive call. We change the axis
     auto nextAxis = (axis + 1) % 3;
-    _left = std::make_shared<BVHNode>(leftShapes, nextAxis);
-    _right = std::make_shared<BVHNode>(rightShapes, nextAxis);
+    _left = arena.make<BVHNode>(begin, middle, nextAxis, arena);
+    _right = arena.make<BVHNode>(middle, end, nextAxis, arena);
   }
 
   /**
@@ -59,34 +56,67 @@ public:
   bool isLeaf() const {return _isLeaf;}
 
   bool hit(const Ray &ray, double minDist, Hit &hit) const {
- // void getHitCandidates(const Ray &ray, ShapeSet &candidates) const {
     bool ok = false;
     if (isLeaf()) {
       // leaf case
-      for (auto shape: _shapes) {
-        ok |= shape->hit(ray, minDist, hit);
+      for (auto it = _begin; it != _end; ++it) {
+        ok |= (*it)->hit(ray, minDist, hit);
       }   
       return ok;
     }
     // internal node case
+    // (the node box is evaluated at the ray time)
     if (!_aabb.hit(ray)) {
       // no intersection with the shapes under this node
       return false;
     }
     // there might be some intersection, continue the traversal
-    assert(_left.get());
-    assert(_right.get());
+    assert(_left);
+    assert(_right);
     ok |= _left->hit(ray, minDist, hit);
     ok |= _right->hit(ray, minDist, hit);
     return ok;
   }
 
+  /**
+   *  Traverse the tree with a packet of rays: each node is loaded once for
+   *  all the rays of the packet that are still active under this node
+   *  @param active indices of the active rays
+   *  @param activeCount number of active rays (at most maxPacketSize)
+   */
+  void hitPacket(const Ray *rays, const unsigned int *active, unsigned int activeCount, 
+      double minDist, Hit *hits, bool *found) const {
+    if (isLeaf()) {
+      for (auto it = _begin; it != _end; ++it) {
+        for (unsigned int i = 0; i < activeCount; ++i) {
+          auto r = active[i];
+          found[r] |= (*it)->hit(rays[r], minDist, hits[r]);
+        }
+      }
+      return;
+    }
+    unsigned int stillActive[maxPacketSize];
+    unsigned int stillActiveCount = 0;
+    for (unsigned int i = 0; i < activeCount; ++i) {
+      if (_aabb.hit(rays[active[i]])) {
+        stillActive[stillActiveCount++] = active[i];
+      }
+    }
+    if (!stillActiveCount) {
+      return;
+    }
+    _left->hitPacket(rays, stillActive, stillActiveCount, minDist, hits, found);
+    _right->hitPacket(rays, stillActive, stillActiveCount, minDist, hits, found);
+  }
+
   const AABB &getAABB() const {return _aabb;}
+  static const unsigned int maxPacketSize = 64;
 private:
   bool _isLeaf;
-  std::shared_ptr<BVHNode> _left;
-  std::shared_ptr<BVHNode> _right;
-  ShapeSet _shapes; // only relevant for the leaves
+  BVHNode *_left;
+  BVHNode *_right;
+  Shape **_begin; // shapes under this node (only relevant for the leaves)
+  Shape **_end;
   AABB _aabb; // bounding box of this node
 };
 
@@ -94,6 +124,8 @@ private:
  *  Bounding volume hierarchies
  *  Structure used to access the list of shapes that a ray might
  *  intersect in log(n) where n is the number of shapes.
+ *  The nodes are allocated in an arena owned by the BVH, and 
+ *  all index one single shape array.
  */
 class BVH: public Shape {
 public:
@@ -101,17 +133,47 @@ public:
    *  Constructor
    *  @param shapes Shapes to be stored in the BVH
    */
-  BVH(const std::vector<Shape *> &shapes): _root(shapes, 0) { 
-    setAABB(_root.getAABB());
+  BVH(const std::vector<Shape *> &shapes): 
+    _shapes(shapes),
+    _nodes(sizeof(BVHNode) * std::max<size_t>(16, shapes.size())),
+    _root(nullptr)
+  { 
+    auto begin = _shapes.data();
+    _root = _nodes.make<BVHNode>(begin, begin + _shapes.size(), 0, _nodes);
+    setAABB(_root->getAABB());
   }
   
   virtual bool hit(const Ray &ray, double minDist, Hit &hit) const {
-    return _root.hit(ray, minDist, hit);
+    return _root->hit(ray, minDist, hit);
   }
-private:
-  BVHNode _root; // root of the binary tree
-};
-
 
+  virtual void hitPacket(const Ray *rays, unsigned int count, double minDist, Hit *hits, bool *found) const {
+    unsigned int active[BVHNode::maxPacketSize];
+    for (unsigned int start = 0; start < count; start += BVHNode::maxPacketSize) {
+      unsigned int size = count - start;
+      if (size > BVHNode::maxPacketSize) {
+        size = BVHNode::maxPacketSize;
+      }
+      for (unsigned int i = 0; i < size; ++i) {
+        active[i] = i;
+      }
+      _root->hitPacket(rays + start, active, size, minDist, hits + start, found + start);
+    }
+  }
 
+  virtual void getMaterials(std::vector<const Material *> &materials) const {
+    for (auto shape: _shapes) {
+      shape->getMaterials(materials);
+    }
+  }
 
+  virtual void getLights(std::vector<const Shape *> &lights) const {
+    for (auto shape: _shapes) {
+      shape->getLights(lights);
+    }
+  }
+private:
+  std::vector<Shape *> _shapes; // reordered such that each node stores a range
+  Arena _nodes; // storage for the nodes
+  BVHNode *_root; // root of the binary tree
+};
@@ -0,0 +1,562 @@
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <cstdint>
+#include <cstring>
+#include <fstream>
+#include <limits>
+#include <memory>
+#include <mutex>
+#include <stdexcept>
+#include <string>
+#include <utility>
+#include <vector>
+#include "Shape.hpp"
+#include "Sphere.hpp"
+#include "Quad.hpp"
+#include "../MappedFile.hpp"
+#include "../Morton.hpp"
+
+/**
+ *  Geometry file (.rtg), for the scenes that do not fit in memory
+ *
+ *  The primitives (spheres and quads) are sorted along a Morton curve
+ *  and grouped into chunks of neighbour primitives. Each chunk stores
+ *  its own BVH followed by its primitives, so that it can be loaded and
+ *  traversed independently of the others (see ChunkedGeometry).
+ *
+ *  Layout: "RTG3", the key of the generator (uint32), the number of
+ *  chunks (uint32), a ChunkInfo per chunk, then the chunks, each one
+ *  being its nodes then its primitives.
+ *  The values are single precision, in the byte order of the machine.
+ */
+class GeometryFile {
+  public:
+    /**
+     *  Primitive with the parameters of its intersection, precomputed
+     */
+    struct Primitive {
+      enum Type : uint32_t {
+        SphereType,
+        QuadType
+      };
+      uint32_t type;
+      uint32_t material; // index in the material table of the ChunkedGeometry
+      // sphere: center, radius
+      // quad: corner, normal, uAxis, vAxis, D (see Quad::getBasis)
+      float data[13];
+    };
+
+    /**
+     *  BVH node. The left child of an internal node follows it, and
+     *  the nodes of a chunk are indexed from the first one.
+     */
+    struct Node {
+      float bounds[6]; // min x, y, z then max x, y, z
+      uint32_t index; // leaf: first primitive, internal: right child
+      uint32_t count; // leaf: number of primitives, internal: 0
+    };
+
+    struct ChunkInfo {
+      float bounds[6];
+      uint64_t offset; // position of the nodes in the file
+      uint32_t nodeCount;
+      uint32_t primitiveCount;
+    };
+
+    void addSphere(const Vec3 &center, double radius, uint32_t material) {
+      Primitive primitive{Primitive::SphereType, material, {}};
+      _set(primitive.data, center);
+      primitive.data[3] = static_cast<float>(radius);
+      _primitives.push_back(primitive);
+      Bounds bounds;
+      for (unsigned int i = 0; i < 3; ++i) {
+        bounds.v[i] = static_cast<float>(center[i] - radius);
+        bounds.v[i + 3] = static_cast<float>(center[i] + radius);
+      }
+      _bounds.push_back(bounds);
+    }
+
+    void addQuad(const Vec3 &corner, const Vec3 &side1, const Vec3 &side2, uint32_t material) {
+      Primitive primitive{Primitive::QuadType, material, {}};
+      Vec3 normal, uAxis, vAxis;
+      Quad::getBasis(side1, side2, normal, uAxis, vAxis);
+      _set(primitive.data, corner);
+      _set(primitive.data + 3, normal);
+      _set(primitive.data + 6, uAxis);
+      _set(primitive.data + 9, vAxis);
+      primitive.data[12] = static_cast<float>(normal * corner);
+      _primitives.push_back(primitive);
+      // bounds of the 4 corners, slightly enlarged for the axis aligned quads
+      const double epsilon = 0.0001;
+      Bounds bounds;
+      for (unsigned int i = 0; i < 3; ++i) {
+        double values[4] = {corner[i], corner[i] + side1[i], corner[i] + side2[i], corner[i] + side1[i] + side2[i]};
+        bounds.v[i] = static_cast<float>(*std::min_element(values, values + 4) - epsilon);
+        bounds.v[i + 3] = static_cast<float>(*std::max_element(values, values + 4) + epsilon);
+      }
+      _bounds.push_back(bounds);
+    }
+
+    /**
+     *  Add the 6 faces of a parallelepiped
+     */
+    void addParallelepiped(const Vec3 &corner, const Vec3 &side1, const Vec3 &side2, const Vec3 &side3,
+        uint32_t material) {
+      auto otherCorner = corner + side1 + side2 + side3;
+      addQuad(corner, side1, side2, material);
+      addQuad(corner, side2, side3, material);
+      addQuad(corner, side3, side1, material);
+      addQuad(otherCorner, -side1, -side2, material);
+      addQuad(otherCorner, -side2, -side3, material);
+      addQuad(otherCorner, -side3, -side1, material);
+    }
+
+    size_t size() const {return _primitives.size();}
+
+    /**
+     *  Key of an existing file, false if there is no file in the
+     *  current format at path
+     */
+    static bool readKey(const std::string &path, uint32_t &key) {
+      std::ifstream is(path, std::ios::binary);
+      char magic[4];
+      return is.read(magic, 4) && std::memcmp(magic, "RTG3", 4) == 0
+        && is.read(reinterpret_cast<char *>(&key), sizeof(key));
+    }
+
+    /**
+     *  @param key value chosen by the generator, such as a hash of its
+     *    parameters, to know if a file can be reused (see readKey)
+     *  @param primitivesPerChunk number of primitives loaded together
+     */
+    void write(const std::string &path, uint32_t key = 0, unsigned int primitivesPerChunk = 4096) const {
+      const auto &bounds = _bounds;
+      AABB all;
+      for (auto &box: bounds) {
+        all.unionWith(box.toAABB());
+      }
+      // spatial order
+      std::vector<std::pair<uint32_t, uint32_t> > keys;
+      for (uint32_t i = 0; i < _primitives.size(); ++i) {
+        keys.push_back(std::make_pair(getMortonCode(bounds[i].getCenter(), all), i));
+      }
+      std::sort(keys.begin(), keys.end());
+      std::vector<ChunkInfo> infos;
+      std::vector<std::vector<Node> > chunkNodes;
+      std::vector<std::vector<Primitive> > chunkPrimitives;
+      for (size_t start = 0; start < keys.size(); start += primitivesPerChunk) {
+        auto end = std::min(keys.size(), start + primitivesPerChunk);
+        std::vector<Primitive> primitives;
+        std::vector<Bounds> primitiveBounds;
+        for (auto i = start; i < end; ++i) {
+          primitives.push_back(_primitives[keys[i].second]);
+          primitiveBounds.push_back(bounds[keys[i].second]);
+        }
+        std::vector<uint32_t> order;
+        chunkNodes.push_back(buildBVH(primitiveBounds, order));
+        chunkPrimitives.push_back({});
+        for (auto i: order) {
+          chunkPrimitives.back().push_back(primitives[i]);
+        }
+        ChunkInfo info;
+        std::memcpy(info.bounds, chunkNodes.back()[0].bounds, sizeof(info.bounds));
+        info.nodeCount = static_cast<uint32_t>(chunkNodes.back().size());
+        info.primitiveCount = static_cast<uint32_t>(primitives.size());
+        infos.push_back(info);
+      }
+      uint64_t offset = 12 + infos.size() * sizeof(ChunkInfo);
+      for (size_t i = 0; i < infos.size(); ++i) {
+        infos[i].offset = offset;
+        offset += infos[i].nodeCount * sizeof(Node) + infos[i].primitiveCount * sizeof(Primitive);
+      }
+      std::ofstream os(path, std::ios::binary);
+      uint32_t count = static_cast<uint32_t>(infos.size());
+      os.write("RTG3", 4);
+      os.write(reinterpret_cast<const char *>(&key), sizeof(key));
+      os.write(reinterpret_cast<const char *>(&count), sizeof(count));
+      os.write(reinterpret_cast<const char *>(infos.data()), infos.size() * sizeof(ChunkInfo));
+      for (size_t i = 0; i < infos.size(); ++i) {
+        os.write(reinterpret_cast<const char *>(chunkNodes[i].data()), chunkNodes[i].size() * sizeof(Node));
+        os.write(reinterpret_cast<const char *>(chunkPrimitives[i].data()), chunkPrimitives[i].size() * sizeof(Primitive));
+      }
+      if (!os) {
+        throw std::runtime_error("Cannot write " + path);
+      }
+    }
+
+    /**
+     *  Box in single precision
+     */
+    struct Bounds {
+      float v[6];
+
+      Bounds() {
+        for (unsigned int i = 0; i < 3; ++i) {
+          v[i] = std::numeric_limits<float>::max();
+          v[i + 3] = -std::numeric_limits<float>::max();
+        }
+      }
+
+      void unionWith(const Bounds &other) {
+        for (unsigned int i = 0; i < 3; ++i) {
+          v[i] = std::min(v[i], other.v[i]);
+          v[i + 3] = std::max(v[i + 3], other.v[i + 3]);
+        }
+      }
+
+      Vec3 getCenter() const {
+        return Vec3(v[0] + v[3], v[1] + v[4], v[2] + v[5]) * 0.5;
+      }
+
+      AABB toAABB() const {
+        return AABB(Interval(v[0], v[3]), Interval(v[1], v[4]), Interval(v[2], v[5]));
+      }
+    };
+
+    /**
+     *  Build a BVH over boxes (median split on the largest axis)
+     *  @param order filled with the indices of the boxes in the order
+     *    of the leaves, to which the leaf indices refer
+     */
+    static std::vector<Node> buildBVH(const std::vector<Bounds> &bounds, std::vector<uint32_t> &order) {
+      order.resize(bounds.size());
+      for (uint32_t i = 0; i < bounds.size(); ++i) {
+        order[i] = i;
+      }
+      std::vector<Node> nodes;
+      if (!bounds.empty()) {
+        _build(bounds, order, 0, static_cast<uint32_t>(bounds.size()), nodes);
+      }
+      return nodes;
+    }
+
+  private:
+    static const uint32_t _leafSize = 4;
+
+    static void _set(float *output, const Vec3 &v) {
+      for (unsigned int i = 0; i < 3; ++i) {
+        output[i] = static_cast<float>(v[i]);
+      }
+    }
+
+    static void _build(const std::vector<Bounds> &bounds, std::vector<uint32_t> &order,
+        uint32_t begin, uint32_t end, std::vector<Node> &nodes) {
+      Bounds box;
+      for (auto i = begin; i < end; ++i) {
+        box.unionWith(bounds[order[i]]);
+      }
+      auto index = nodes.size();
+      nodes.push_back(Node());
+      std::memcpy(nodes[index].bounds, box.v, sizeof(box.v));
+      if (end - begin <= _leafSize) {
+        nodes[index].index = begin;
+        nodes[index].count = end - begin;
+        return;
+      }
+      unsigned int axis = 0;
+      for (unsigned int i = 1; i < 3; ++i) {
+        if (box.v[i + 3] - box.v[i] > box.v[axis + 3] - box.v[axis]) {
+          axis = i;
+        }
+      }
+      auto middle = begin + (end - begin) / 2;
+      std::nth_element(order.begin() + begin, order.begin() + middle, order.begin() + end,
+          [&](uint32_t i1, uint32_t i2) {
+            return bounds[i1].v[axis] + bounds[i1].v[axis + 3] < bounds[i2].v[axis] + bounds[i2].v[axis + 3];
+          });
+      _build(bounds, order, begin, middle, nodes);
+      nodes[index].index = static_cast<uint32_t>(nodes.size());
+      nodes[index].count = 0;
+      _build(bounds, order, middle, end, nodes);
+    }
+
+    std::vector<Primitive> _primitives;
+    std::vector<Bounds> _bounds; // of each primitive
+};
+
+/**
+ *  Shape whose geometry stays in a geometry file (see GeometryFile),
+ *  for the scenes larger than the memory
+ *
+ *  Only the table of the chunks and a BVH over their boxes are kept in
+ *  memory. The chunks (BVH and primitives) are read from the mapped
+ *  file when a ray reaches their box, and kept in a cache of limited
+ *  size: when a new chunk exceeds the budget, the least recently used
+ *  chunks are evicted. A chunk in use by a thread stays valid until the
+ *  thread releases it, even if evicted meanwhile.
+ *  hitPacket first finds the chunks reached by each ray of the packet,
+ *  then processes the rays chunk by chunk, such that each chunk is
+ *  requested once per packet: the wavefront integrator with large
+ *  packets (Camera::setRaySorting(true, 256)) amortizes the loads.
+ */
+class ChunkedGeometry : public Shape {
+  public:
+    /**
+     *  @param materials table of the materials (not owned) to which the
+     *    material indices of the primitives refer
+     *  @param budget maximum size of the loaded chunks, in bytes
+     */
+    ChunkedGeometry(const std::string &path, const std::vector<const Material *> &materials,
+        size_t budget = size_t(256) << 20):
+      _file(path),
+      _budget(budget),
+      _usedBytes(0),
+      _clock(0),
+      _loads(0)
+    {
+      char magic[4];
+      uint32_t count = 0;
+      _file.read(0, 4, magic);
+      if (std::memcmp(magic, "RTG3", 4) != 0) {
+        throw std::runtime_error("Not a geometry file: " + path);
+      }
+      _file.read(8, sizeof(count), &count);
+      _infos.resize(count);
+      if (count) {
+        _file.read(12, count * sizeof(GeometryFile::ChunkInfo), _infos.data());
+      }
+      _slots.reset(new Slot[count]);
+      for (auto material: materials) {
+        _surfaces.emplace_back(*material, false);
+        _surfaces.emplace_back(*material, true);
+      }
+      // top level BVH
+      std::vector<GeometryFile::Bounds> bounds(count);
+      AABB all;
+      for (uint32_t i = 0; i < count; ++i) {
+        std::memcpy(bounds[i].v, _infos[i].bounds, sizeof(bounds[i].v));
+        all.unionWith(bounds[i].toAABB());
+      }
+      _nodes = GeometryFile::buildBVH(bounds, _chunkOrder);
+      setAABB(all);
+    }
+    virtual ~ChunkedGeometry() {}
+
+    virtual bool hit(const Ray &ray, double minDist, Hit &hit) const {
+      if (_nodes.empty()) {
+        return false;
+      }
+      RayData data(ray);
+      bool found = false;
+      _traverse(_nodes.data(), data, hit.dist, [&](uint32_t first, uint32_t count) {
+        for (auto i = first; i < first + count; ++i) {
+          auto chunk = _acquire(_chunkOrder[i]);
+          found |= _hitChunk(*chunk, ray, data, minDist, hit);
+        }
+      });
+      return found;
+    }
+
+    virtual void hitPacket(const Ray *rays, unsigned int count, double minDist, Hit *hits, bool *found) const {
+      if (_nodes.empty()) {
+        return;
+      }
+      // (chunk, ray) pairs
+      std::vector<std::pair<uint32_t, uint32_t> > visits;
+      for (uint32_t r = 0; r < count; ++r) {
+        RayData data(rays[r]);
+        _traverse(_nodes.data(), data, hits[r].dist, [&](uint32_t first, uint32_t leafCount) {
+          for (auto i = first; i < first + leafCount; ++i) {
+            visits.push_back(std::make_pair(_chunkOrder[i], r));
+          }
+        });
+      }
+      std::sort(visits.begin(), visits.end());
+      std::shared_ptr<const Chunk> chunk;
+      for (size_t i = 0; i < visits.size(); ++i) {
+        if (i == 0 || visits[i].first != visits[i - 1].first) {
+          chunk = _acquire(visits[i].first);
+        }
+        auto r = visits[i].second;
+        found[r] |= _hitChunk(*chunk, rays[r], RayData(rays[r]), minDist, hits[r]);
+      }
+    }
+
+    virtual void getMaterials(std::vector<const Material *> &materials) const {
+      for (size_t i = 0; i < _surfaces.size(); i += 2) {
+        materials.push_back(&_surfaces[i].getMaterial());
+      }
+    }
+
+    size_t getChunkCount() const {return _infos.size();}
+
+    /**
+     *  Size of the chunks in the cache, in bytes
+     */
+    size_t getUsedBytes() const {return _usedBytes;}
+
+    /**
+     *  Number of chunks read from the file since the creation
+     */
+    size_t getLoadCount() const {return _loads;}
+
+  private:
+    /**
+     *  Shape returned in the hits, carrying the material of the primitive
+     *  and the texture coordinates of the spheres
+     */
+    class Surface : public Shape {
+      public:
+        Surface(const Material &material, bool spherical): Shape(material), _spherical(spherical) {}
+        virtual bool hit(const Ray &, double, Hit &) const {return false;}
+        virtual void setTextureCoordinates(Hit &hit) const {
+          if (_spherical) {
+            Sphere::setSphericalCoordinates(hit);
+          }
+        }
+
+      private:
+        bool _spherical;
+    };
+
+    struct Chunk {
+      std::vector<GeometryFile::Node> nodes;
+      std::vector<GeometryFile::Primitive> primitives;
+    };
+
+    struct Slot {
+      std::shared_ptr<const Chunk> chunk; // null if not loaded
+      std::atomic<uint64_t> lastUse{0};
+    };
+
+    struct RayData {
+      explicit RayData(const Ray &ray) {
+        for (unsigned int i = 0; i < 3; ++i) {
+          origin[i] = ray.origin()[i];
+          inverse[i] = 1.0 / ray.direction()[i];
+        }
+      }
+      double origin[3];
+      double inverse[3];
+    };
+
+    static bool _hitBox(const float *bounds, const RayData &ray, double maxDist) {
+      double tMin = 0.0;
+      double tMax = maxDist;
+      for (unsigned int i = 0; i < 3; ++i) {
+        double t0 = (bounds[i] - ray.origin[i]) * ray.inverse[i];
+        double t1 = (bounds[i + 3] - ray.origin[i]) * ray.inverse[i];
+        if (ray.inverse[i] < 0.0) {
+          std::swap(t0, t1);
+        }
+        tMin = std::max(tMin, t0);
+        tMax = std::min(tMax, t1);
+        if (tMax < tMin) {
+          return false;
+        }
+      }
+      return true;
+    }
+
+    /**
+     *  Call leaf(first, count) for the leaves of the BVH whose box
+     *  is hit closer than maxDist (re-read after each leaf)
+     */
+    template<typename F>
+    static void _traverse(const GeometryFile::Node *nodes, const RayData &ray, const double &maxDist, F leaf) {
+      uint32_t stack[64];
+      unsigned int size = 0;
+      stack[size++] = 0;
+      while (size) {
+        const auto &node = nodes[stack[--size]];
+        if (!_hitBox(node.bounds, ray, maxDist)) {
+          continue;
+        }
+        if (node.count) {
+          leaf(node.index, node.count);
+        } else {
+          stack[size++] = node.index;
+          stack[size++] = static_cast<uint32_t>(&node - nodes + 1);
+        }
+      }
+    }
+
+    bool _hitChunk(const Chunk &chunk, const Ray &ray, const RayData &data, double minDist, Hit &hit) const {
+      bool found = false;
+      _traverse(chunk.nodes.data(), data, hit.dist, [&](uint32_t first, uint32_t count) {
+        for (auto i = first; i < first + count; ++i) {
+          const auto &primitive = chunk.primitives[i];
+          const float *d = primitive.data;
+          bool ok;
+          bool spherical = primitive.type == GeometryFile::Primitive::SphereType;
+          if (spherical) {
+            ok = Sphere::hitSphere(Vec3(d[0], d[1], d[2]), d[3], double(d[3]) * d[3], ray, minDist, hit);
+          } else {
+            ok = Quad::hitQuad(Vec3(d[0], d[1], d[2]), Vec3(d[3], d[4], d[5]), d[12],
+                Vec3(d[6], d[7], d[8]), Vec3(d[9], d[10], d[11]), ray, minDist, hit);
+          }
+          if (ok) {
+            hit.shape = &_surfaces[2 * primitive.material + (spherical ? 1 : 0)];
+            found = true;
+          }
+        }
+      });
+      return found;
+    }
+
+    /**
+     *  Chunk from the cache, loaded if needed
+     */
+    std::shared_ptr<const Chunk> _acquire(uint32_t index) const {
+      auto &slot = _slots[index];
+      slot.lastUse.store(_clock.load(std::memory_order_relaxed), std::memory_order_relaxed);
+      auto chunk = std::atomic_load(&slot.chunk);
+      if (chunk) {
+        return chunk;
+      }
+      std::lock_guard<std::mutex> lock(_mutex);
+      chunk = std::atomic_load(&slot.chunk);
+      if (chunk) {
+        return chunk;
+      }
+      const auto &info = _infos[index];
+      auto loaded = std::make_shared<Chunk>();
+      loaded->nodes.resize(info.nodeCount);
+      loaded->primitives.resize(info.primitiveCount);
+      auto nodesSize = info.nodeCount * sizeof(GeometryFile::Node);
+      _file.read(info.offset, nodesSize, loaded->nodes.data());
+      _file.read(info.offset + nodesSize, info.primitiveCount * sizeof(GeometryFile::Primitive), loaded->primitives.data());
+      // a file written with more materials than the table
+      for (auto &primitive: loaded->primitives) {
+        if (2 * size_t(primitive.material) >= _surfaces.size()) {
+          throw std::runtime_error("Material index out of the table in " + _file.path());
+        }
+      }
+      chunk = loaded;
+      std::atomic_store(&slot.chunk, chunk);
+      slot.lastUse = ++_clock;
+      _loaded.push_back(index);
+      _usedBytes += _getSize(index);
+      ++_loads;
+      // evict the least recently used chunks, except this one
+      while (_usedBytes > _budget && _loaded.size() > 1) {
+        auto victim = std::min_element(_loaded.begin(), _loaded.end() - 1, [this](uint32_t i1, uint32_t i2) {
+          return _slots[i1].lastUse < _slots[i2].lastUse;
+        });
+        std::atomic_store(&_slots[*victim].chunk, std::shared_ptr<const Chunk>());
+        _usedBytes -= _getSize(*victim);
+        _loaded.erase(victim);
+      }
+      return chunk;
+    }
+
+    size_t _getSize(uint32_t index) const {
+      return _infos[index].nodeCount * sizeof(GeometryFile::Node)
+        + _infos[index].primitiveCount * sizeof(GeometryFile::Primitive);
+    }
+
+    MappedFile _file;
+    std::vector<GeometryFile::ChunkInfo> _infos;
+    std::vector<GeometryFile::Node> _nodes; // BVH over the chunks
+    std::vector<uint32_t> _chunkOrder; // chunk of each leaf entry of _nodes
+    std::vector<Surface> _surfaces; // two per material: quads and spheres
+    size_t _budget;
+    mutable std::unique_ptr<Slot[]> _slots; // one per chunk
+    mutable std::vector<uint32_t> _loaded; // indices of the loaded chunks
+    mutable std::atomic<size_t> _usedBytes;
+    mutable std::atomic<uint64_t> _clock; // incremented at each load, for the LRU order
+    mutable std::atomic<size_t> _loads;
+    mutable std::mutex _mutex; // loads and evictions
+};
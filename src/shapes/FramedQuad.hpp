@@ -28,6 +28,14 @@ class FramedQuad : public Shape {
     virtual bool hit(const Ray &ray, double minDist, Hit &hit) const {
       return _shapes.hit(ray, minDist, hit);
     }
+
+    virtual void getMaterials(std::vector<const Material *> &materials) const {
+      _shapes.getMaterials(materials);
+    }
+
+    virtual void getLights(std::vector<const Shape *> &lights) const {
+      _shapes.getLights(lights);
+    }
   private:
     std::shared_ptr<Quad> _in;
     std::shared_ptr<Quad> _out;
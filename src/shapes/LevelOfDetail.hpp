@@ -0,0 +1,74 @@
+#pragma once
+
+#include <assert.h>
+#include <algorithm>
+#include <cmath>
+#include <vector>
+#include "Shape.hpp"
+
+/**
+ *  Object with several versions (not owned), from the finest to the
+ *  coarsest: each ray is traced against the coarsest version whose
+ *  error is smaller than the width of its cone (see Ray::setCone) at
+ *  the bounding box. The distant instances, and the rays of the
+ *  diffuse bounces, then traverse the simplified geometry (fewer
+ *  shapes and nodes to load), while the close ones keep all the detail.
+ *  The shapes of the levels are not sampled as lights, since a light
+ *  sample and a ray could see different levels.
+ */
+class LevelOfDetail : public Shape {
+  public:
+    LevelOfDetail() {}
+    virtual ~LevelOfDetail() {}
+
+    /**
+     *  Add the next coarser level
+     *  @param error largest distance between the surfaces of this
+     *    level and of the finest one (0 for the finest one)
+     */
+    void addLevel(Shape *shape, double error) {
+      assert(_levels.empty() || error >= _levels.back().error);
+      _levels.push_back(Level{shape, error});
+      getAABB().unionWith(shape->getAABB());
+    }
+
+    unsigned int getLevelCount() const {return static_cast<unsigned int>(_levels.size());}
+
+    virtual bool hit(const Ray &ray, double minDist, Hit &hit) const {
+      return _getLevel(ray).hit(ray, minDist, hit);
+    }
+
+    virtual void getMaterials(std::vector<const Material *> &materials) const {
+      for (auto &level: _levels) {
+        level.shape->getMaterials(materials);
+      }
+    }
+
+  private:
+    struct Level {
+      Shape *shape;
+      double error;
+    };
+
+    /**
+     *  The width of the cone at the nearest point of the box is the
+     *  smallest over the object
+     */
+    const Shape &_getLevel(const Ray &ray) const {
+      double distSquare = 0.0;
+      for (unsigned int i = 0; i < 3; ++i) {
+        auto interval = getAABB().getSweptInterval(i);
+        auto outside = std::max(0.0, std::max(interval.min - ray.origin()[i], ray.origin()[i] - interval.max));
+        distSquare += outside * outside;
+      }
+      auto footprint = ray.getFootprint(std::sqrt(distSquare));
+      unsigned int level = 0;
+      while (level + 1 < _levels.size() && _levels[level + 1].error <= footprint) {
+        ++level;
+      }
+      return *_levels[level].shape;
+    }
+
+  private:
+    std::vector<Level> _levels;
+};
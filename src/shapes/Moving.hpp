@@ -0,0 +1,40 @@
+#pragma once
+
+#include "Shape.hpp"
+
+/**
+ *  Wrapper moving a shape (not owned) linearly during the shutter interval:
+ *  the shape is at its original position at time 0, and is
+ *  translated by displacement at time 1.
+ */
+class Moving : public Shape {
+  public:
+    Moving(Shape *shape, const Vec3 &displacement):
+      _shape(shape),
+      _displacement(displacement) 
+    {
+      auto &aabb = _shape->getAABB();
+      setAABB(AABB(aabb, aabb.translated(_displacement)));
+    }
+
+    virtual ~Moving() {}
+
+    virtual bool hit(const Ray &ray, double minDist, Hit &hit) const {
+      // instead of moving the shape, we move the ray in the other direction
+      auto offset = _displacement * ray.time();
+      Ray movedRay(ray.origin() - offset, ray.direction(), ray.time());
+      if (!_shape->hit(movedRay, minDist, hit)) {
+        return false;
+      }
+      hit.point += offset;
+      return true;
+    }
+
+    virtual void getMaterials(std::vector<const Material *> &materials) const {
+      _shape->getMaterials(materials);
+    }
+
+  private:
+    Shape *_shape;
+    Vec3 _displacement;
+};
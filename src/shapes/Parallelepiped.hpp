@@ -1,32 +1,111 @@
 #pragma once
 
-#include "Quad.hpp"
+#include <limits>
+#include "Shape.hpp"
 
-class Parallelepiped: public Shapes {
+/**
+ *  Parallelepiped (box with any orientation and shear) given by one
+ *  corner and three sides.
+ *  The ray is expressed in the coordinates of the basis of the sides,
+ *  in which the shape is the unit cube: one slab test gives the entry
+ *  and exit points, instead of intersecting the six faces.
+ */
+class Parallelepiped: public Shape {
 public:
     Parallelepiped(const Vec3 &corner,
-        const Vec3 &side1, 
+        const Vec3 &side1,
         const Vec3 &side2,
         const Vec3 &side3,
         const Material &material,
-        Material *debug = nullptr) {
-            addFace(std::make_shared<Quad>(corner, side1, side2, material));
-            addFace(std::make_shared<Quad>(corner, side2, side3, material));
-            addFace(std::make_shared<Quad>(corner, side3, side1, material));
-            auto otherCorner = corner + side1 + side2 + side3;
-            addFace(std::make_shared<Quad>(otherCorner, -side1, -side2, material));
-            addFace(std::make_shared<Quad>(otherCorner, -side2, -side3, material));
-            addFace(std::make_shared<Quad>(otherCorner, -side3, -side1, material));
+        Material *debug = nullptr):
+          Shape(material),
+          _corner(corner) {
+            // the rows of the inverse of the matrix (side1 side2 side3)
+            auto det = side1 * (side2 ^ side3);
+            _rows[0] = (side2 ^ side3) / det;
+            _rows[1] = (side3 ^ side1) / det;
+            _rows[2] = (side1 ^ side2) / det;
+            for (unsigned int i = 0; i < 3; ++i) {
+              _normals[i] = _rows[i].getNormalized();
+            }
+            Vec3 sides[3] = {side1, side2, side3};
+            Interval box[3];
+            for (unsigned int i = 0; i < 3; ++i) {
+              double m = corner[i];
+              double M = corner[i];
+              for (unsigned int j = 0; j < 3; ++j) {
+                m += std::min(0.0, sides[j][i]);
+                M += std::max(0.0, sides[j][i]);
+              }
+              box[i] = Interval(m, M);
+            }
+            setAABB(AABB(box[0], box[1], box[2]));
         }
 
-
-
-
-private:
-    void addFace(std::shared_ptr<Quad> face) {
-        addShape(face.get());
-        _faces.push_back(face);
+    virtual bool hit(const Ray &ray, double minDist, Hit &hit) const {
+      auto origin = ray.origin() - _corner;
+      double tNear = -std::numeric_limits<double>::infinity();
+      double tFar = std::numeric_limits<double>::infinity();
+      // face (axis and side) of the entry and exit points
+      unsigned int nearAxis = 0;
+      unsigned int farAxis = 0;
+      bool nearMax = false;
+      bool farMax = false;
+      double localOrigin[3];
+      double localDirection[3];
+      for (unsigned int i = 0; i < 3; ++i) {
+        localOrigin[i] = _rows[i] * origin;
+        localDirection[i] = _rows[i] * ray.direction();
+        if (localDirection[i] == 0.0) {
+          if (localOrigin[i] < 0.0 || localOrigin[i] > 1.0) {
+            return false;
+          }
+          continue;
+        }
+        // distances to the planes of local coordinate 0 and 1
+        double t0 = -localOrigin[i] / localDirection[i];
+        double t1 = (1.0 - localOrigin[i]) / localDirection[i];
+        bool swapped = t0 > t1;
+        if (swapped) {
+          std::swap(t0, t1);
+        }
+        if (t0 > tNear) {
+          tNear = t0;
+          nearAxis = i;
+          nearMax = swapped;
+        }
+        if (t1 < tFar) {
+          tFar = t1;
+          farAxis = i;
+          farMax = !swapped;
+        }
+        if (tNear > tFar) {
+          return false;
+        }
+      }
+      // the exit point if the origin is inside
+      bool frontFace = tNear >= minDist;
+      double t = frontFace ? tNear : tFar;
+      if (t < minDist || t > hit.dist) {
+        return false;
+      }
+      unsigned int axis = frontFace ? nearAxis : farAxis;
+      bool isMax = frontFace ? nearMax : farMax;
+      hit.point = ray.origin() + ray.direction() * t;
+      hit.dist = t;
+      // outward normal, then on the side of the origin
+      auto normal = isMax ? _normals[axis] : -_normals[axis];
+      hit.frontFace = frontFace;
+      hit.normal = frontFace ? normal : -normal;
+      // the two other local coordinates
+      hit.u = localOrigin[(axis + 1) % 3] + t * localDirection[(axis + 1) % 3];
+      hit.v = localOrigin[(axis + 2) % 3] + t * localDirection[(axis + 2) % 3];
+      hit.shape = this;
+      return true;
     }
-    std::vector<std::shared_ptr<Quad> > _faces;
 
-};
\ No newline at end of file
+private:
+    Vec3 _corner;
+    Vec3 _rows[3]; // the local coordinate i of P is _rows[i] * (P - _corner)
+    Vec3 _normals[3]; // unit normal of the faces of each local axis
+};
@@ -11,9 +11,7 @@ class Quad : public Shape {
       Shape(material),
       _corner(corner),
       _side1(side1),
-      _side2(side2),
-      _normal((side1 ^ side2)),
-      _D(_normal * _corner)
+      _side2(side2)
   {  
     auto corner2 = _corner + _side1 + _side2;
     Interval box[3];
@@ -28,41 +26,89 @@ class Quad : public Shape {
       box[i] = Interval(m, M);
     }
     setAABB(AABB(box[0], box[1], box[2]));
-    _precomputedVec = _normal / (_normal * _normal);
+    getBasis(side1, side2, _normal, _uAxis, _vAxis);
+    _D = _normal * _corner;
   }
 
   virtual bool hit(const Ray &ray, double minDist, Hit &hit) const {
-    double den = _normal * ray.direction();
+    if (!hitQuad(_corner, _normal, _D, _uAxis, _vAxis, ray, minDist, hit)) {
+      return false;
+    }
+    hit.shape = this;
+    return true;
+  }
+
+  virtual double getArea() const {return (_side1 ^ _side2).norm();}
+
+  virtual void samplePoint(double u, double v, Hit &hit) const {
+    hit.point = _corner + _side1 * u + _side2 * v;
+    hit.normal = _normal;
+    hit.u = u;
+    hit.v = v;
+    hit.shape = this;
+  }
+
+  /**
+   *  Both sides of a quad emit, the cone contains the two normals
+   */
+  virtual void getNormalBounds(Vec3 &axis, double &cosTheta) const {
+    axis = _normal;
+    cosTheta = 1.0;
+  }
+
+  /**
+   *  Values precomputed for the intersection
+   *  @param normal unit normal of the plane
+   *  @param uAxis, vAxis vectors such that the coordinates of a point P
+   *    of the plane in the basis of the sides are
+   *    ((P - corner) * uAxis, (P - corner) * vAxis)
+   */
+  static void getBasis(const Vec3 &side1, const Vec3 &side2, Vec3 &normal, Vec3 &uAxis, Vec3 &vAxis) {
+    auto n = side1 ^ side2;
+    // with w = n / |n|^2, the coordinate along side1 is w . (QP ^ side2),
+    // which is also QP . (side2 ^ w): the cross products are done once
+    auto w = n / (n * n);
+    normal = n.getNormalized();
+    uAxis = side2 ^ w;
+    vAxis = w ^ side1;
+  }
+
+  /**
+   *  Intersection of a ray with a quad given by its corner and the
+   *  values precomputed by getBasis, closer than hit.dist. Fills all
+   *  the fields of hit but the shape.
+   *  @param D equation of the plane: normal * P = D
+   */
+  static bool hitQuad(const Vec3 &corner, const Vec3 &normal, double D, const Vec3 &uAxis, const Vec3 &vAxis,
+      const Ray &ray, double minDist, Hit &hit) {
+    double den = normal * ray.direction();
     if (den == 0.0) {
       // the ray and the plane are parallel, no intersection
       return false;
     }
     // t is the point such that the intersection point P = ray.or + t * ray.dir
-    double t = (_D - _normal * ray.origin()) / den;
+    double t = (D - normal * ray.origin()) / den;
     if (t < minDist || t > hit.dist) {
       return false;
     }
     Vec3 P = ray.origin() + ray.direction() * t;
-    // compute alpha and beta such that P = corner + alpha side1 + beta side2
-    // solution: cross product (P-corner) with side1 and with side2, dot product with
-    // the normal, and then we get two equations to compute alpha and beta respectively
-    auto QP = P - _corner;
-    auto alpha = _precomputedVec * (QP ^ _side2);
+    // alpha and beta such that P = corner + alpha side1 + beta side2
+    auto QP = P - corner;
+    auto alpha = QP * uAxis;
     if (alpha < 0.0 || alpha > 1.0) {
       return false;
     }
-    auto beta = _precomputedVec * (_side1 ^ QP);
+    auto beta = QP * vAxis;
     if (beta < 0.0 || beta > 1.0) {
       return false;
     }
     // there is a hit!
     hit.point = P;
     hit.dist = t;
-    hit.normal = _normal.getNormalized();
-    if (hit.normal * ray.direction() > 0.0) {
-      hit.normal = -hit.normal;
-    }
-    hit.shape = this;
+    hit.u = alpha;
+    hit.v = beta;
+    hit.frontFace = den < 0.0;
+    hit.normal = hit.frontFace ? normal : -normal;
     return true;
   }
 
@@ -70,8 +116,9 @@ class Quad : public Shape {
     Vec3 _corner; // one corner of the quad
     Vec3 _side1;  // one side of the quad (corner + side == another corner)
     Vec3 _side2;  // the other side
-    Vec3 _normal; // normal of the plane containing the quad
+    Vec3 _normal; // unit normal of the plane containing the quad
     double _D; // The plane equation is Ax + By + Cz = D, where (A,B,C) is the normal
-    Vec3 _precomputedVec;
+    Vec3 _uAxis; // see getBasis
+    Vec3 _vAxis;
 };
 
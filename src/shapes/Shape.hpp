@@ -15,6 +15,81 @@ class Shape {
     virtual void setAABB(const AABB &aabb) {_aabb = aabb;}
     virtual const Material &getMaterial() const {return _material;}
     virtual bool hit(const Ray &ray, double minDist, Hit &hit) const = 0;
+    /**
+     *  Texture coordinates of a hit of the shape, for the shapes whose
+     *  hit does not compute them (only needed for the textured
+     *  materials, once the closest hit is known)
+     */
+    virtual void setTextureCoordinates(Hit &hit) const {(void)hit;}
+    /**
+     *  Intersect a packet of rays: same as calling hit on each ray, 
+     *  and setting found[i] to true if rays[i] hits the shape. Shapes
+     *  with a hierarchy can share their traversal between the rays
+     */
+    virtual void hitPacket(const Ray *rays, unsigned int count, double minDist, Hit *hits, bool *found) const {
+      for (unsigned int i = 0; i < count; ++i) {
+        found[i] |= hit(rays[i], minDist, hits[i]);
+      }
+    }
+    /**
+     *  Append the materials of the shape (of its children for the
+     *  groups of shapes)
+     */
+    virtual void getMaterials(std::vector<const Material *> &materials) const {
+      materials.push_back(&_material);
+    }
+    /**
+     *  Append the light sources that can be sampled (this shape, or its
+     *  children for the groups of shapes)
+     */
+    virtual void getLights(std::vector<const Shape *> &lights) const {
+      if (getArea() > 0.0 && _material.isLight()) {
+        lights.push_back(this);
+      }
+    }
+    /**
+     *  Area of the surface, 0 if the points of the surface cannot be
+     *  sampled (see samplePoint)
+     */
+    virtual double getArea() const {return 0.0;}
+    /**
+     *  Point of the surface drawn uniformly from (u, v) in [0, 1)^2.
+     *  Fills the point, the outward normal, the texture coordinates and
+     *  the shape of hit.
+     */
+    virtual void samplePoint(double u, double v, Hit &hit) const {
+      (void)u;
+      (void)v;
+      (void)hit;
+    }
+    /**
+     *  Point of the surface drawn from (u, v) in [0, 1)^2 to light the
+     *  point p, uniformly over the area by default (see samplePoint)
+     *  @param pdf density of the direction of the point from p, in
+     *    solid angle (0 if the point cannot light p)
+     */
+    virtual void sampleFrom(const Vec3 &p, double u, double v, Hit &hit, double &pdf) const {
+      samplePoint(u, v, hit);
+      pdf = getPdfFrom(p, hit);
+    }
+    /**
+     *  Density (solid angle) with which sampleFrom draws the point of
+     *  hit from p
+     */
+    virtual double getPdfFrom(const Vec3 &p, const Hit &hit) const {
+      auto direction = hit.point - p;
+      auto distSquare = direction.normSquare();
+      auto cosine = distSquare > 0.0 ? std::abs(hit.normal * direction) / std::sqrt(distSquare) : 0.0;
+      return cosine > 0.0 ? distSquare / (getArea() * cosine) : 0.0;
+    }
+    /**
+     *  Cone containing the normals of the surface: unit axis, and cosine
+     *  of its half angle (-1 for all the directions)
+     */
+    virtual void getNormalBounds(Vec3 &axis, double &cosTheta) const {
+      axis = Vec3(0.0, 0.0, 1.0);
+      cosTheta = -1.0;
+    }
     virtual const AABB &getAABB() const {return _aabb;}
     virtual AABB &getAABB() {return _aabb;}
   private:
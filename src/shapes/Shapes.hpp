@@ -21,6 +21,22 @@ class Shapes : public Shape {
       }
       return ok;
     }
+    virtual void hitPacket(const Ray *rays, unsigned int count, double minDist, Hit *hits, bool *found) const {
+      for (auto shape: _shapes) {
+        shape->hitPacket(rays, count, minDist, hits, found);
+      }
+    }
+    virtual void getMaterials(std::vector<const Material *> &materials) const {
+      for (auto shape: _shapes) {
+        shape->getMaterials(materials);
+      }
+    }
+
+    virtual void getLights(std::vector<const Shape *> &lights) const {
+      for (auto shape: _shapes) {
+        shape->getLights(lights);
+      }
+    }
     const std::vector<Shape *> &getShapes() const {return _shapes;}
   private:
     std::vector<Shape *> _shapes;
@@ -1,5 +1,6 @@
 #pragma once
 
+#include "../Bsdf.hpp"
 
 class Sphere : public Shape {
   public:
@@ -15,45 +16,150 @@ class Sphere : public Shape {
       }
     virtual ~Sphere() {}
     virtual bool hit(const Ray &ray, double minDist, Hit &hit) const {
+      if (!hitSphere(_center, _radius, _radiusSquare, ray, minDist, hit)) {
+        return false;
+      }
+      hit.shape = this;
+      return true;
+    }
+
+    virtual void setTextureCoordinates(Hit &hit) const {setSphericalCoordinates(hit);}
+
+    /**
+     *  Spherical texture coordinates of a hit, from its normal: u around
+     *  the vertical axis, v from bottom to top
+     */
+    static void setSphericalCoordinates(Hit &hit) {
+      auto normal = hit.frontFace ? hit.normal : -hit.normal;
+      hit.u = 0.5 + atan2(-normal[2], normal[0]) / (2.0 * M_PI);
+      hit.v = acos(std::max(-1.0, std::min(1.0, -normal[1]))) / M_PI;
+    }
+
+    /**
+     *  Intersection of a ray with the sphere of given center and radius,
+     *  closer than hit.dist. Fills all the fields of hit but the shape
+     *  and the texture coordinates (see setSphericalCoordinates).
+     */
+    static bool hitSphere(const Vec3 &center, double radius, double radiusSquare,
+        const Ray &ray, double minDist, Hit &hit) {
       // O is the origin, C the center
       // Pc the project of C on the ray
       // P1 is one of the potential 2 intersections with the sphere
-      auto OC = _center - ray.origin();
+      auto OC = center - ray.origin();
       auto normOPc = OC * ray.direction();
-      if (normOPc < 0.0) {
+      auto OCSquare = OC.normSquare();
+      if (normOPc < 0.0 && OCSquare > radiusSquare) {
         // the object is behind the eye
         return false;
       }
       auto normOPcSquare = normOPc * normOPc;
-      auto CPcSquare = OC.normSquare() - normOPcSquare;
+      auto CPcSquare = OCSquare - normOPcSquare;
       
-      auto P1PCSQuare = _radiusSquare - CPcSquare;
+      auto P1PCSQuare = radiusSquare - CPcSquare;
       if (P1PCSQuare <= 0.0) {
         // no hit with the sphere
         return false;
       }
       auto P1PCnorm = sqrt(P1PCSQuare);
       auto dist1 = normOPc - P1PCnorm;
+      if (dist1 < minDist) {
+        // the origin is inside the sphere (refracted rays): exit point
+        dist1 = normOPc + P1PCnorm;
+      }
       if (dist1 < minDist || dist1 > hit.dist) {
         return false;
       }
       auto P1 = ray.origin() + ray.direction() * dist1;
       hit.point = P1;
       hit.dist = dist1;
-      hit.normal = (P1 - _center).getNormalized();
-      hit.shape = this;
+      hit.normal = (P1 - center) / radius;
+      hit.frontFace = hit.normal * ray.direction() < 0.0;
+      if (!hit.frontFace) {
+        hit.normal = -hit.normal;
+      }
       return true;
     }
+
+    virtual double getArea() const {return 4.0 * M_PI * _radiusSquare;}
+
+    virtual void samplePoint(double u, double v, Hit &hit) const {
+      auto z = 1.0 - 2.0 * u;
+      auto r = sqrt(std::max(0.0, 1.0 - z * z));
+      auto phi = 2.0 * M_PI * v;
+      hit.normal = Vec3(r * cos(phi), r * sin(phi), z);
+      hit.point = _center + hit.normal * _radius;
+      hit.frontFace = true;
+      setSphericalCoordinates(hit);
+      hit.shape = this;
+    }
+
+    /**
+     *  From outside the sphere, the directions of the cone that it
+     *  subtends are drawn uniformly: all the points are on the visible
+     *  side, while half of the points drawn over the area are hidden by
+     *  the sphere itself
+     */
+    virtual void sampleFrom(const Vec3 &p, double u, double v, Hit &hit, double &pdf) const {
+      auto toCenter = _center - p;
+      auto distSquare = toCenter.normSquare();
+      double solidAngle;
+      if (!_getSolidAngle(distSquare, solidAngle)) {
+        Shape::sampleFrom(p, u, v, hit, pdf);
+        return;
+      }
+      auto dist = sqrt(distSquare);
+      auto axis = toCenter / dist;
+      auto cosThetaMax = 1.0 - solidAngle / (2.0 * M_PI);
+      auto cosTheta = 1.0 - u * (1.0 - cosThetaMax);
+      auto sinThetaSquare = std::max(0.0, 1.0 - cosTheta * cosTheta);
+      auto sinTheta = sqrt(sinThetaSquare);
+      auto phi = 2.0 * M_PI * v;
+      Vec3 t, b;
+      buildBasis(axis, t, b);
+      auto direction = axis * cosTheta + t * (sinTheta * cos(phi)) + b * (sinTheta * sin(phi));
+      // nearest intersection of the direction with the sphere
+      auto distHit = dist * cosTheta - sqrt(std::max(0.0, _radiusSquare - distSquare * sinThetaSquare));
+      hit.point = p + direction * distHit;
+      hit.normal = (hit.point - _center) / _radius;
+      hit.frontFace = true;
+      setSphericalCoordinates(hit);
+      hit.shape = this;
+      pdf = 1.0 / solidAngle;
+    }
+
+    virtual double getPdfFrom(const Vec3 &p, const Hit &hit) const {
+      double solidAngle;
+      if (!_getSolidAngle((_center - p).normSquare(), solidAngle)) {
+        return Shape::getPdfFrom(p, hit);
+      }
+      return 1.0 / solidAngle;
+    }
+
     const Vec3& center() const {return _center;}
     
     double radius() const {return _radius;}
 
-    bool intersect(const Sphere &other) {
+    bool intersect(const Sphere &other) const {
       auto d = (other.center() - center()).norm();
       return d < (radius() + other.radius());
     }
 
   private:
+    /**
+     *  Solid angle of the sphere seen from a point at a squared
+     *  distance of the center
+     *  @return false if the point is not outside the sphere
+     */
+    bool _getSolidAngle(double distSquare, double &solidAngle) const {
+      auto sinSquare = _radiusSquare / distSquare;
+      if (sinSquare >= 1.0 - 1e-6) {
+        return false;
+      }
+      // 2 pi (1 - cos(thetaMax)), without the cancellation of the small spheres
+      solidAngle = 2.0 * M_PI * sinSquare / (1.0 + sqrt(1.0 - sinSquare));
+      return true;
+    }
+
     Vec3 _center;
     double _radius;
     double _radiusSquare;
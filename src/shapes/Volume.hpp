@@ -0,0 +1,61 @@
+#pragma once
+
+#include "Shape.hpp"
+#include "../Medium.hpp"
+
+/**
+ *  Participating medium filling a closed convex shape (not owned)
+ *  The rays are hit where they collide with a particle of the medium,
+ *  and go through the volume otherwise. The material should be
+ *  isotropic (see Material::isotropic), its color is the probability of
+ *  scattering (instead of absorbing) at a collision.
+ */
+class Volume : public Shape {
+  public:
+    Volume(const Shape *boundary, const Medium *medium, const Material &material):
+      Shape(material),
+      _boundary(boundary),
+      _medium(medium)
+    {
+      setAABB(_boundary->getAABB());
+    }
+    virtual ~Volume() {}
+
+    virtual bool hit(const Ray &ray, double minDist, Hit &hit) const {
+      Hit first;
+      if (!_boundary->hit(ray, minDist, first)) {
+        return false;
+      }
+      // segment of the ray inside the boundary
+      double tEnter = first.dist;
+      double tExit;
+      Hit second;
+      const double epsilon = 0.00001;
+      if (_boundary->hit(ray, first.dist + epsilon, second)) {
+        tExit = second.dist;
+      } else {
+        // the origin is inside
+        tEnter = minDist;
+        tExit = first.dist;
+      }
+      // closer shapes occlude the rest of the volume
+      tExit = std::min(tExit, hit.dist);
+      double t;
+      if (tEnter >= tExit || !_medium->sampleCollision(ray, tEnter, tExit, t)) {
+        return false;
+      }
+      hit.point = ray.origin() + ray.direction() * t;
+      hit.dist = t;
+      // no surface: any normal works with an isotropic phase function
+      hit.normal = -ray.direction();
+      hit.frontFace = true;
+      hit.u = 0.0;
+      hit.v = 0.0;
+      hit.shape = this;
+      return true;
+    }
+
+  private:
+    const Shape *_boundary;
+    const Medium *_medium;
+};